@@ -0,0 +1,461 @@
+#define _GNU_SOURCE
+
+#include "builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "job_list.h"
+#include "result_cache.h"
+#include "string_vector.h"
+#include "swish_funcs.h"
+#include "watch_run.h"
+
+// Seeds tried per table size before the table is doubled
+#define MAX_SEED_TRIES 1024
+
+static builtin_t *registry = NULL;    // every registered builtin
+static unsigned num_builtins = 0;
+static unsigned registry_capacity = 0;
+
+// Perfect hash table: index into 'registry' for each slot, or -1 if empty.
+// 'hash_seed' is chosen so that no two registered names share a slot.
+static int *slots = NULL;
+static unsigned num_slots = 0;    // always a power of two
+static uint32_t hash_seed = 0;
+
+static int builtin_pwd(strvec_t *tokens, shell_t *shell) {
+  char buf[PATH_MAX];
+  if (getcwd(buf, PATH_MAX) == NULL) {
+    perror("getcwd");
+    return -1;
+  }
+  printf("%s\n", buf);
+  return 0;
+}
+
+static int builtin_cd(strvec_t *tokens, shell_t *shell) {
+  // argument for directory to change to
+  const char *second_token = strvec_get(tokens, 1);
+  const char *dir;
+
+  // if cd is used alone, move to user's home directory
+  if (second_token == NULL) {
+    dir = getenv("HOME");
+  } else {
+    dir = second_token;
+  }
+
+  // change the directory and handle errors accordingly
+  if (chdir(dir) != 0) {
+    perror("chdir");
+    return -1;
+  }
+  return 0;
+}
+
+static int builtin_exit(strvec_t *tokens, shell_t *shell) {
+  shell->exiting = 1;
+  return 0;
+}
+
+// Task 5: Print out current list of pending jobs
+static int builtin_jobs(strvec_t *tokens, shell_t *shell) {
+  // Print out the output captured for a background job
+  if (tokens->length > 1 && strcmp(strvec_get(tokens, 1), "output") == 0) {
+    if (print_job_output(tokens, &shell->jobs) == -1) {
+      printf("Failed to print job output\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  int i = 0;
+  job_t *current = shell->jobs.head;
+  while (current != NULL) {
+    char *status_desc;
+    if (current->status == BACKGROUND) {
+      status_desc = "background";
+    } else if (current->status == TIMED_OUT) {
+      status_desc = "timed out";
+    } else {
+      status_desc = "stopped";
+    }
+    printf("%d: %s (%s)\n", i, current->name, status_desc);
+    i++;
+    current = current->next;
+  }
+  return 0;
+}
+
+// Task 5: Move stopped job into foreground
+static int builtin_fg(strvec_t *tokens, shell_t *shell) {
+  if (resume_job(tokens, &shell->jobs, 1) == -1) {
+    printf("Failed to resume job in foreground\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Task 6: Move stopped job into background
+static int builtin_bg(strvec_t *tokens, shell_t *shell) {
+  if (resume_job(tokens, &shell->jobs, 0) == -1) {
+    printf("Failed to resume job in background\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Task 6: Wait for a specific job identified by its index in job list
+static int builtin_wait_for(strvec_t *tokens, shell_t *shell) {
+  if (await_background_job(tokens, &shell->jobs) == -1) {
+    printf("Failed to wait for background job\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Task 6: Wait for all background jobs
+static int builtin_wait_all(strvec_t *tokens, shell_t *shell) {
+  if (await_all_background_jobs(&shell->jobs) == -1) {
+    printf("Failed to wait for all background jobs\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Send output of later background jobs to in-memory buffers (or not)
+static int builtin_capture(strvec_t *tokens, shell_t *shell) {
+  const char *mode = strvec_get(tokens, 1);
+  if (mode != NULL && strcmp(mode, "on") == 0) {
+    shell->capture_output = 1;
+  } else if (mode != NULL && strcmp(mode, "off") == 0) {
+    shell->capture_output = 0;
+  } else {
+    printf("Usage: capture on|off\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Re-run a command whenever its input files change, until the job is killed
+static int builtin_watch_run(strvec_t *tokens, shell_t *shell) {
+  return watch_run(tokens);
+}
+
+// Replay a stored result of an identical earlier run, or run and store it
+static int builtin_cached(strvec_t *tokens, shell_t *shell) {
+  return run_cached(tokens);
+}
+
+static const builtin_t core_builtins[] = {
+    {"pwd", builtin_pwd, BUILTIN_REDIRECT | BUILTIN_BACKGROUND},
+    {"cd", builtin_cd, 0},
+    {"exit", builtin_exit, 0},
+    {"jobs", builtin_jobs, BUILTIN_REDIRECT},
+    {"fg", builtin_fg, 0},
+    {"bg", builtin_bg, 0},
+    {"wait-for", builtin_wait_for, 0},
+    {"wait-all", builtin_wait_all, 0},
+    {"capture", builtin_capture, 0},
+    {"watch-run", builtin_watch_run, BUILTIN_CHILD},
+    {"cached", builtin_cached, BUILTIN_CHILD},
+};
+
+// seeded FNV-1a with a final avalanche, so every seed yields an
+// independent-looking mapping even in the low bits used for the slot
+static uint32_t hash_name(const char *name, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (; *name != '\0'; name++) {
+    h ^= (unsigned char) *name;
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+// Search for a seed that maps every registered name to a distinct slot,
+// doubling the table whenever no seed works at the current size
+static int build_perfect_hash(void) {
+  unsigned size = 1;
+  while (size < 2 * num_builtins) {
+    size <<= 1;
+  }
+
+  while (1) {
+    int *table = malloc(size * sizeof(int));
+    if (table == NULL) {
+      perror("malloc");
+      return -1;
+    }
+
+    for (uint32_t seed = 1; seed <= MAX_SEED_TRIES; seed++) {
+      memset(table, -1, size * sizeof(int));
+      int collision = 0;
+      for (unsigned i = 0; i < num_builtins && !collision; i++) {
+        uint32_t slot = hash_name(registry[i].name, seed) & (size - 1);
+        if (table[slot] != -1) {
+          collision = 1;
+        } else {
+          table[slot] = i;
+        }
+      }
+
+      if (!collision) {
+        free(slots);
+        slots = table;
+        num_slots = size;
+        hash_seed = seed;
+        return 0;
+      }
+    }
+
+    free(table);
+    size <<= 1;
+  }
+}
+
+int builtins_init(void) {
+  for (int i = 0; i < sizeof(core_builtins) / sizeof(builtin_t); i++) {
+    if (builtin_register(core_builtins[i].name, core_builtins[i].fn,
+                         core_builtins[i].flags) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void builtins_free(void) {
+  free(registry);
+  free(slots);
+  registry = NULL;
+  slots = NULL;
+  num_builtins = 0;
+  registry_capacity = 0;
+  num_slots = 0;
+}
+
+int builtin_register(const char *name, builtin_fn_t fn, int flags) {
+  if (builtin_lookup(name) != NULL) {
+    fprintf(stderr, "Builtin '%s' is already registered\n", name);
+    return -1;
+  }
+
+  if (num_builtins == registry_capacity) {
+    unsigned capacity = registry_capacity == 0 ? 16 : 2 * registry_capacity;
+    builtin_t *new_registry = realloc(registry, capacity * sizeof(builtin_t));
+    if (new_registry == NULL) {
+      perror("realloc");
+      return -1;
+    }
+    registry = new_registry;
+    registry_capacity = capacity;
+  }
+
+  registry[num_builtins].name = name;
+  registry[num_builtins].fn = fn;
+  registry[num_builtins].flags = flags;
+  num_builtins++;
+
+  if (build_perfect_hash() == -1) {
+    num_builtins--;
+    return -1;
+  }
+  return 0;
+}
+
+const builtin_t *builtin_lookup(const char *name) {
+  if (num_slots == 0) {
+    return NULL;
+  }
+
+  // a perfect hash: only one candidate can possibly match
+  int idx = slots[hash_name(name, hash_seed) & (num_slots - 1)];
+  if (idx != -1 && strcmp(registry[idx].name, name) == 0) {
+    return &registry[idx];
+  }
+  return NULL;
+}
+
+const builtin_t *builtin_get(unsigned idx) {
+  if (idx >= num_builtins) {
+    return NULL;
+  }
+  return &registry[idx];
+}
+
+// copy the whole contents of 'memfd' to 'fd', falling back to read/write
+// for targets sendfile(2) can't handle (e.g., O_APPEND files)
+static int copy_output(int memfd, int fd) {
+  off_t off = 0;
+  ssize_t n;
+  while ((n = sendfile(fd, memfd, &off, 1 << 20)) > 0) {
+  }
+  if (n == -1 && errno == EINVAL) {
+    char buf[4096];
+    while ((n = pread(memfd, buf, sizeof(buf), off)) > 0) {
+      if (write_all(fd, buf, n) == -1) {
+        return -1;
+      }
+      off += n;
+    }
+    if (n == -1) {
+      perror("read");
+      return -1;
+    }
+  }
+  if (n == -1) {
+    perror("sendfile");
+    return -1;
+  }
+  return 0;
+}
+
+// run a builtin in a new background job, redirections apply to the child only
+static int spawn_builtin(const builtin_t *builtin, strvec_t *tokens,
+                         shell_t *shell) {
+  // captured jobs write stdout and stderr into a pipe that the shell drains
+  // into the job's output buffer
+  int out_pipe[2] = {-1, -1};
+  if (shell->capture_output && pipe2(out_pipe, O_CLOEXEC) == -1) {
+    perror("pipe2");
+    out_pipe[0] = out_pipe[1] = -1;
+  }
+
+  spawn_opts_t opts = {.null_stdin = shell->isolate_jobs,
+                       .out_fd = out_pipe[1],
+                       .err_fd = out_pipe[1],
+                       .mask = shell->job_mask,
+                       .close_fds = shell->isolate_jobs,
+                       .timeout = NULL,
+                       .output_pipe = out_pipe[0],
+                       .builtin = builtin,
+                       .shell = shell};
+  pid_t pid = spawn_job(tokens, &opts, &shell->jobs, BACKGROUND);
+  if (out_pipe[1] != -1) {
+    close(out_pipe[1]);
+  }
+  return pid == -1 ? -1 : 0;
+}
+
+// Run a builtin in the shell itself, with its redirections (if any) applied
+// to the shell's stdin and stdout for the duration of the call
+static int run_redirected(const builtin_t *builtin, strvec_t *tokens,
+                          shell_t *shell) {
+  int redirect_idx = find_redirection(tokens);
+  if (redirect_idx == -1) {
+    return builtin->fn(tokens, shell);
+  }
+  if (!(builtin->flags & BUILTIN_REDIRECT)) {
+    fprintf(stderr, "%s: does not support redirection\n", builtin->name);
+    return -1;
+  }
+
+  redirections_t redirs;
+  if (open_redirections(tokens, &redirs) == -1) {
+    return -1;
+  }
+  strvec_take(tokens, redirect_idx);
+
+  // with several output targets, buffer the output in memory and copy it
+  // to each target afterwards, the shell itself can't become a fan-out pump
+  int out_fd = redirs.num_out == 1 ? redirs.out_fds[0] : -1;
+  int memfd = -1;
+  if (redirs.num_out > 1) {
+    if ((memfd = memfd_create("swish-builtin-output", MFD_CLOEXEC)) == -1) {
+      perror("memfd_create");
+      close_redirections(&redirs);
+      return -1;
+    }
+    out_fd = memfd;
+  }
+
+  // redirect the shell's own stdin/stdout around the call, then restore them
+  fflush(stdout);
+  int saved_stdin = dup(STDIN_FILENO);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int ret = -1;
+  if (saved_stdin == -1 || saved_stdout == -1) {
+    perror("dup");
+  } else if ((redirs.in_fd != -1 && dup2(redirs.in_fd, STDIN_FILENO) == -1) ||
+             (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1)) {
+    perror("dup2");
+  } else {
+    ret = builtin->fn(tokens, shell);
+    fflush(stdout);
+  }
+
+  if ((saved_stdin != -1 && dup2(saved_stdin, STDIN_FILENO) == -1) ||
+      (saved_stdout != -1 && dup2(saved_stdout, STDOUT_FILENO) == -1)) {
+    perror("dup2");
+    ret = -1;
+  }
+  if (saved_stdin != -1) {
+    close(saved_stdin);
+  }
+  if (saved_stdout != -1) {
+    close(saved_stdout);
+  }
+
+  if (memfd != -1) {
+    for (int i = 0; i < redirs.num_out; i++) {
+      if (copy_output(memfd, redirs.out_fds[i]) == -1) {
+        ret = -1;
+      }
+    }
+    close(memfd);
+  }
+  close_redirections(&redirs);
+  return ret;
+}
+
+int run_builtin(const builtin_t *builtin, strvec_t *tokens, shell_t *shell) {
+  // check if the builtin is intended to be run in the background
+  if (tokens->length > 1 &&
+      strcmp(strvec_get(tokens, tokens->length - 1), "&") == 0) {
+    if (!(builtin->flags & BUILTIN_BACKGROUND)) {
+      fprintf(stderr, "%s: cannot be run in the background\n", builtin->name);
+      return -1;
+    }
+    strvec_take(tokens, tokens->length - 1);
+    return spawn_builtin(builtin, tokens, shell);
+  }
+
+  // start any process substitutions first, the redirections may name them
+  substitutions_t subs;
+  if (open_substitutions(tokens, shell->job_mask, &subs) == -1) {
+    return -1;
+  }
+  if (subs.num == 0) {
+    return run_redirected(builtin, tokens, shell);
+  }
+
+  // a substitution that exits early must not take the shell down with it
+  struct sigaction ignore = {.sa_handler = SIG_IGN};
+  struct sigaction old_pipe;
+  sigemptyset(&ignore.sa_mask);
+  if (sigaction(SIGPIPE, &ignore, &old_pipe) == -1) {
+    perror("sigaction");
+    close_substitutions(&subs);
+    return -1;
+  }
+  int ret = run_redirected(builtin, tokens, shell);
+  close_substitutions(&subs);
+  if (sigaction(SIGPIPE, &old_pipe, NULL) == -1) {
+    perror("sigaction");
+    ret = -1;
+  }
+  return ret;
+}
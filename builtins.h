@@ -0,0 +1,92 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <signal.h>
+
+#include "job_list.h"
+#include "string_vector.h"
+
+// Redirections ("<", ">", ">>") in the command are applied to the builtin
+#define BUILTIN_REDIRECT 0x1
+// A trailing "&" runs the builtin in a child process as a background job
+#define BUILTIN_BACKGROUND 0x2
+// The builtin runs in the child process of a regular job rather than in the
+// shell, so "&", "timeout" and redirections work as for any other command.
+// Its handler gets a NULL shell and its return value (unless -1) becomes the
+// job's exit status.
+#define BUILTIN_CHILD 0x4
+
+// State of the shell that builtins may inspect or modify
+typedef struct {
+  job_list_t jobs;       // the shell's current jobs
+  int capture_output;    // 1 if background job output goes to memory buffers
+  int exiting;           // set to 1 to make the shell exit after this command
+  const sigset_t *job_mask;    // signal mask for background builtins, or NULL
+  int isolate_jobs;      // 1 if background builtins get /dev/null as stdin
+                         // and none of the shell's other descriptors
+} shell_t;
+
+/*
+ * Handler for a builtin command
+ * tokens: Tokens of the command with any "&" and redirections removed,
+ *         tokens[0] is the builtin's name
+ * shell: The shell running the builtin
+ * Returns 0 on success or -1 on error
+ */
+typedef int (*builtin_fn_t)(strvec_t *tokens, shell_t *shell);
+
+typedef struct {
+  const char *name;
+  builtin_fn_t fn;
+  int flags;    // bitwise OR of BUILTIN_* flags
+} builtin_t;
+
+/*
+ * Register the shell's core builtins (pwd, cd, exit, jobs, fg, bg, ...)
+ * Returns 0 on success or -1 on error
+ */
+int builtins_init(void);
+
+/*
+ * Unregister all builtins and free the registry's memory
+ */
+void builtins_free(void);
+
+/*
+ * Add a new builtin to the registry
+ * The lookup table is regenerated so that every registered name still hashes
+ * to its own slot, keeping lookups to one hash and one string comparison.
+ * name: The builtin's command name. Must remain valid while it is registered.
+ * fn: Function that runs the builtin
+ * flags: Bitwise OR of BUILTIN_* flags, or 0
+ * Returns 0 on success or -1 on error (including if 'name' is already taken)
+ */
+int builtin_register(const char *name, builtin_fn_t fn, int flags);
+
+/*
+ * Find the builtin with a given name
+ * name: Command name to look up, e.g., the first token typed in by the user
+ * Returns a pointer to the builtin or NULL if 'name' is not a builtin
+ */
+const builtin_t *builtin_lookup(const char *name);
+
+/*
+ * Get a registered builtin by its position in the registry, e.g., to list
+ * the names of all builtins
+ * idx: Index of the builtin, in registration order
+ * Returns a pointer to the builtin or NULL if 'idx' is out of bounds
+ */
+const builtin_t *builtin_get(unsigned idx);
+
+/*
+ * Run a builtin, honoring its flags: a trailing "&" and redirections are
+ * rejected unless the builtin supports them
+ * Builtins with BUILTIN_CHILD are started as jobs instead, see run_job()
+ * builtin: The builtin to run, as returned by builtin_lookup()
+ * tokens: Tokens from the command typed in by the user
+ * shell: The shell running the builtin
+ * Returns 0 on success or -1 on error
+ */
+int run_builtin(const builtin_t *builtin, strvec_t *tokens, shell_t *shell);
+
+#endif    // BUILTINS_H
@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+
+#include "completion.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "string_vector.h"
+#include "trie.h"
+
+// A directory whose entries were added to a trie
+typedef struct {
+  char *path;
+  struct stat st;       // as of the last read, to detect changes
+  int loaded;           // 1 if 'names' are in the trie
+  strvec_t names;       // entries added to the trie
+} cached_dir_t;
+
+// builtins and $PATH executables
+static trie_t commands;
+static int builtins_added = 0;
+static char *path_var = NULL;    // $PATH that 'path_dirs' was built from
+static cached_dir_t *path_dirs = NULL;
+static unsigned num_path_dirs = 0;
+
+// entries of the directory of the last completed file name
+static trie_t files;
+static cached_dir_t files_dir = {.path = NULL, .loaded = 0};
+
+static int same_version(const struct stat *a, const struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Remove a directory's entries from a trie
+static void unload_dir(cached_dir_t *dir, trie_t *trie) {
+  if (!dir->loaded) {
+    return;
+  }
+  for (unsigned i = 0; i < dir->names.length; i++) {
+    trie_remove(trie, strvec_get(&dir->names, i));
+  }
+  strvec_clear(&dir->names);
+  dir->loaded = 0;
+}
+
+// Add a directory's entries to a trie, either its executables or all its
+// entries with "/" appended to subdirectories
+static int load_dir(cached_dir_t *dir, trie_t *trie, int executables) {
+  DIR *d = opendir(dir->path);
+  if (d == NULL) {
+    // missing directories on $PATH are common, they just add no names
+    return 0;
+  }
+  strvec_init(&dir->names);
+  dir->loaded = 1;
+
+  char name[NAME_MAX + 2];
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    strcpy(name, entry->d_name);
+
+    int is_dir = entry->d_type == DT_DIR;
+    if (executables || entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+      struct stat st;
+      if (fstatat(dirfd(d), entry->d_name, &st, 0) == -1) {
+        continue;
+      }
+      if (executables && (!S_ISREG(st.st_mode) || (st.st_mode & 0111) == 0)) {
+        continue;
+      }
+      is_dir = S_ISDIR(st.st_mode);
+    }
+    if (!executables && is_dir) {
+      strcat(name, "/");
+    }
+
+    if (trie_insert(trie, name) == -1 || strvec_add(&dir->names, name) == -1) {
+      closedir(d);
+      return -1;
+    }
+  }
+  closedir(d);
+  return 0;
+}
+
+// Bring a directory's entries in a trie up to date, returns 0 on success or
+// -1 on error
+static int refresh_dir(cached_dir_t *dir, trie_t *trie, int executables) {
+  struct stat st;
+  if (stat(dir->path, &st) == -1) {
+    unload_dir(dir, trie);
+    return 0;
+  }
+  if (dir->loaded && same_version(&st, &dir->st)) {
+    return 0;
+  }
+  unload_dir(dir, trie);
+  dir->st = st;
+  return load_dir(dir, trie, executables);
+}
+
+static void free_path_dirs(void) {
+  for (unsigned i = 0; i < num_path_dirs; i++) {
+    unload_dir(&path_dirs[i], &commands);
+    free(path_dirs[i].path);
+  }
+  free(path_dirs);
+  path_dirs = NULL;
+  num_path_dirs = 0;
+  free(path_var);
+  path_var = NULL;
+}
+
+// Split $PATH into directories, each of which is read on its next refresh
+static int parse_path(const char *path) {
+  free_path_dirs();
+  if ((path_var = strdup(path)) == NULL) {
+    perror("strdup");
+    return -1;
+  }
+
+  unsigned max_dirs = 1;
+  for (const char *c = path; *c != '\0'; c++) {
+    max_dirs += *c == ':';
+  }
+  if ((path_dirs = calloc(max_dirs, sizeof(cached_dir_t))) == NULL) {
+    perror("calloc");
+    return -1;
+  }
+
+  char *copy = strdup(path);
+  if (copy == NULL) {
+    perror("strdup");
+    return -1;
+  }
+  char *save = NULL;
+  for (char *dir = strtok_r(copy, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save)) {
+    if ((path_dirs[num_path_dirs].path = strdup(dir)) == NULL) {
+      perror("strdup");
+      free(copy);
+      return -1;
+    }
+    num_path_dirs++;
+  }
+  free(copy);
+  return 0;
+}
+
+static int refresh_commands(void) {
+  if (!builtins_added) {
+    const builtin_t *builtin;
+    for (unsigned i = 0; (builtin = builtin_get(i)) != NULL; i++) {
+      if (trie_insert(&commands, builtin->name) == -1) {
+        return -1;
+      }
+    }
+    builtins_added = 1;
+  }
+
+  const char *path = getenv("PATH");
+  if (path == NULL) {
+    path = "";
+  }
+  if ((path_var == NULL || strcmp(path, path_var) != 0) && parse_path(path) == -1) {
+    return -1;
+  }
+  for (unsigned i = 0; i < num_path_dirs; i++) {
+    if (refresh_dir(&path_dirs[i], &commands, 1) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Point the files trie at a directory ("" is the current directory)
+static int refresh_files(const char *dir, unsigned len) {
+  char path[PATH_MAX];
+  if (len == 0 || dir[0] != '/') {
+    // relative names are keyed by absolute path since cd moves them
+    if (getcwd(path, sizeof(path)) == NULL) {
+      perror("getcwd");
+      return -1;
+    }
+    if (snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%.*s", len, dir) >=
+        (int) (sizeof(path) - strlen(path))) {
+      return -1;
+    }
+  } else if (snprintf(path, sizeof(path), "%.*s", len, dir) >= (int) sizeof(path)) {
+    return -1;
+  }
+
+  if (files_dir.path == NULL || strcmp(files_dir.path, path) != 0) {
+    unload_dir(&files_dir, &files);
+    free(files_dir.path);
+    if ((files_dir.path = strdup(path)) == NULL) {
+      perror("strdup");
+      return -1;
+    }
+  }
+  return refresh_dir(&files_dir, &files, 0);
+}
+
+int complete_word(const char *word, int is_command, completion_t *comp) {
+  comp->count = 0;
+  comp->common[0] = '\0';
+  strvec_init(&comp->shown);
+
+  const trie_t *trie;
+  const char *base = strrchr(word, '/');
+  if (is_command && base == NULL) {
+    if (refresh_commands() == -1) {
+      return -1;
+    }
+    trie = &commands;
+    base = word;
+  } else {
+    unsigned dir_len = base == NULL ? 0 : base - word + 1;
+    if (refresh_files(word, dir_len) == -1) {
+      return -1;
+    }
+    trie = &files;
+    base = word + dir_len;
+  }
+
+  comp->count = trie_count(trie, base);
+  if (trie_common_prefix(trie, base, comp->common, sizeof(comp->common)) == -1 ||
+      trie_matches(trie, base, &comp->shown, COMPLETION_MAX_SHOWN) == -1) {
+    completion_clear(comp);
+    return -1;
+  }
+  return 0;
+}
+
+void completion_clear(completion_t *comp) {
+  strvec_clear(&comp->shown);
+}
+
+void completion_free(void) {
+  free_path_dirs();
+  trie_free(&commands);
+  builtins_added = 0;
+  unload_dir(&files_dir, &files);
+  free(files_dir.path);
+  files_dir.path = NULL;
+  trie_free(&files);
+}
@@ -0,0 +1,45 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <limits.h>
+
+#include "string_vector.h"
+
+// Most candidates listed for an ambiguous completion
+#define COMPLETION_MAX_SHOWN 100
+
+typedef struct {
+  unsigned count;          // number of candidates
+  char common[PATH_MAX];   // longest prefix shared by all candidates
+  strvec_t shown;          // the first COMPLETION_MAX_SHOWN candidates, sorted
+} completion_t;
+
+/*
+ * Find the completions of a partial word on the command line
+ * Command names are completed from the builtins and the executables in the
+ * directories on $PATH. Anything else is completed from the names of the
+ * files in the word's directory (the current directory if the word has no
+ * "/"), with "/" appended to directory names. Candidates are kept in prefix
+ * tries (see trie.h). A directory is only read again once its modification
+ * time changes, so repeated completions cost a stat(2) per directory.
+ * Candidates and 'common' are names within the word's directory, i.e., they
+ * complete the part of 'word' after its last "/".
+ * word: The partial word
+ * is_command: 1 if the word is a command name, 0 otherwise
+ * comp: Set to the completions, release with completion_clear()
+ * Returns 0 on success or -1 on error
+ */
+int complete_word(const char *word, int is_command, completion_t *comp);
+
+/*
+ * Free the memory used by a completion_t
+ * comp: The completions to free
+ */
+void completion_clear(completion_t *comp);
+
+/*
+ * Free the cached completion candidates
+ */
+void completion_free(void);
+
+#endif    // COMPLETION_H
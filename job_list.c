@@ -6,10 +6,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+// frees a job along with its captured output, if any
+static void job_free(job_t *job) {
+    if (job->output_pipe != -1) {
+        close(job->output_pipe);
+    }
+    if (job->output_fd != -1) {
+        close(job->output_fd);
+    }
+    free(job);
+}
 
 void job_list_init(job_list_t *list) {
     list->head = NULL;
     list->length = 0;
+    list->timer_fd = -1;
+    list->poll_fds = NULL;
+    list->poll_capacity = 0;
 }
 
 void job_list_free(job_list_t *list) {
@@ -17,10 +32,17 @@ void job_list_free(job_list_t *list) {
     while (current != NULL) {
         job_t *temp = current;
         current = current->next;
-        free(temp);
+        job_free(temp);
     }
     list->head = NULL;
     list->length = 0;
+    if (list->timer_fd != -1) {
+        close(list->timer_fd);
+        list->timer_fd = -1;
+    }
+    free(list->poll_fds);
+    list->poll_fds = NULL;
+    list->poll_capacity = 0;
 }
 
 int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t status) {
@@ -33,6 +55,12 @@ int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t sta
         list->head->status = status;
         list->head->next = NULL;
         list->head->pid = pid;
+        list->head->deadline.tv_sec = 0;
+        list->head->deadline.tv_nsec = 0;
+        list->head->term_sent = 0;
+        list->head->output_pipe = -1;
+        list->head->output_fd = -1;
+        list->head->output_len = 0;
         list->length = 1;
         return 0;
     }
@@ -49,6 +77,12 @@ int job_list_add(job_list_t *list, pid_t pid, const char *name, job_status_t sta
     current->next->status = status;
     current->next->next = NULL;
     current->next->pid = pid;
+    current->next->deadline.tv_sec = 0;
+    current->next->deadline.tv_nsec = 0;
+    current->next->term_sent = 0;
+    current->next->output_pipe = -1;
+    current->next->output_fd = -1;
+    current->next->output_len = 0;
     list->length++;
     return 0;
 }
@@ -76,7 +110,7 @@ int job_list_remove(job_list_t *list, unsigned idx) {
     if (idx == 0) {
         job_t *temp = list->head;
         list->head = list->head->next;
-        free(temp);
+        job_free(temp);
         list->length--;
         return 0;
     }
@@ -87,7 +121,7 @@ int job_list_remove(job_list_t *list, unsigned idx) {
     }
     job_t *temp = current->next;
     current->next = current->next->next;
-    free(temp);
+    job_free(temp);
     list->length--;
     return 0;
 }
@@ -97,7 +131,7 @@ void job_list_remove_by_status(job_list_t *list, job_status_t status) {
         job_t *temp = list->head;
         list->head = list->head->next;
         list->length--;
-        free(temp);
+        job_free(temp);
     }
 
     if (list->head != NULL) {    // Could have removed all nodes in loop above
@@ -107,7 +141,7 @@ void job_list_remove_by_status(job_list_t *list, job_status_t status) {
                 job_t *temp = current->next;
                 current->next = current->next->next;
                 list->length--;
-                free(temp);
+                job_free(temp);
             } else {
                 current = current->next;
             }
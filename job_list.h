@@ -4,26 +4,38 @@
 #ifndef JOB_LIST_H
 #define JOB_LIST_H
 
+#include <poll.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define NAME_LEN 32
 
 typedef enum {
     STOPPED,
     BACKGROUND,
+    FOREGROUND,
+    TIMED_OUT,
 } job_status_t;
 
 typedef struct job {
     char name[NAME_LEN];
     int status;
     pid_t pid;
+    struct timespec deadline;    // CLOCK_MONOTONIC expiry time, {0, 0} if none
+    int term_sent;               // 1 once SIGTERM was sent, next expiry sends SIGKILL
+    int output_pipe;             // read end of captured stdout/stderr, -1 if none
+    int output_fd;               // memfd ring buffer holding captured output, -1 if none
+    size_t output_len;           // total bytes captured so far (ring keeps the tail)
     struct job *next;
 } job_t;
 
 typedef struct {
     job_t *head;
     unsigned length;
+    int timer_fd;    // timerfd armed for the earliest job deadline, -1 until needed
+    struct pollfd *poll_fds;    // reused while waiting on the jobs, see poll_jobs()
+    unsigned poll_capacity;     // entries allocated in 'poll_fds'
 } job_list_t;
 
 /*
@@ -34,7 +46,8 @@ void job_list_init(job_list_t *list);
 
 /*
  * Removes all entries from a jobs list
- * The underlying memory for the entries is also freed
+ * The underlying memory for the entries, the list's deadline timer and its
+ * poll buffer is also freed
  * list: Pointer to the job list to clear
  */
 void job_list_free(job_list_t *list);
@@ -59,7 +72,7 @@ job_t *job_list_get(job_list_t *list, unsigned idx);
 
 /*
  * Removes an element at a specific index from a jobs list
- * The memory for this element is freed
+ * The memory for this element, including its captured output buffer, is freed
  * list: Pointer to the jobs list to remove from
  * idx: Index of the element to remove
  * Returns 0 on success or -1 on error
@@ -68,7 +81,7 @@ int job_list_remove(job_list_t *list, unsigned idx);
 
 /*
  * Remove all jobs of a specific status (STOPPED or BACKGROUND) from a jobs list
- * The memory for all entries removed from the list is freed
+ * The memory (and captured output) for all entries removed from the list is freed
  * list: The jobs list to remove from
  * status: The status of all jobs that should be removed (BACKGROUND or STOPPED)
  */
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+
+#include "job_output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "job_list.h"
+
+// copy 'len' bytes of the memfd starting at 'off' to 'fd' without going
+// through a userspace buffer
+static int copy_range(int memfd, off_t off, size_t len, int fd) {
+  while (len > 0) {
+    ssize_t n = sendfile(fd, memfd, &off, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("sendfile");
+      return -1;
+    } else if (n == 0) {
+      break;
+    }
+    len -= n;
+  }
+  return 0;
+}
+
+int job_output_attach(job_t *job, int pipe_fd) {
+  // the pipe is drained opportunistically, so it must never block the shell
+  if (fcntl(pipe_fd, F_SETFL, O_NONBLOCK) == -1) {
+    perror("fcntl");
+    close(pipe_fd);
+    return -1;
+  }
+
+  int memfd = memfd_create("swish-job-output", MFD_CLOEXEC);
+  if (memfd == -1) {
+    perror("memfd_create");
+    close(pipe_fd);
+    return -1;
+  }
+
+  job->output_pipe = pipe_fd;
+  job->output_fd = memfd;
+  job->output_len = 0;
+  return 0;
+}
+
+int job_output_drain(job_t *job) {
+  while (job->output_pipe != -1) {
+    // never splice past the end of the ring, wrap around on the next pass
+    loff_t off = job->output_len % OUTPUT_RING_SIZE;
+    ssize_t n = splice(job->output_pipe, NULL, job->output_fd, &off,
+                       OUTPUT_RING_SIZE - off, SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      job->output_len += n;
+    } else if (n == 0) {
+      // every writer has exited, nothing more will arrive
+      close(job->output_pipe);
+      job->output_pipe = -1;
+    } else if (errno == EAGAIN) {
+      break;
+    } else if (errno != EINTR) {
+      perror("splice");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int job_output_drain_all(job_list_t *jobs) {
+  int ret = 0;
+  for (job_t *current = jobs->head; current != NULL; current = current->next) {
+    if (job_output_drain(current) == -1) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+int job_output_write(const job_t *job, int fd) {
+  if (job->output_fd == -1) {
+    return 0;
+  }
+
+  if (job->output_len <= OUTPUT_RING_SIZE) {
+    return copy_range(job->output_fd, 0, job->output_len, fd);
+  }
+
+  // ring has wrapped: oldest retained byte sits at the write position
+  off_t pos = job->output_len % OUTPUT_RING_SIZE;
+  if (copy_range(job->output_fd, pos, OUTPUT_RING_SIZE - pos, fd) == -1) {
+    return -1;
+  }
+  return copy_range(job->output_fd, 0, pos, fd);
+}
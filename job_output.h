@@ -0,0 +1,42 @@
+#ifndef JOB_OUTPUT_H
+#define JOB_OUTPUT_H
+
+#include "job_list.h"
+
+// Bytes of captured output kept per job, older output is overwritten
+#define OUTPUT_RING_SIZE (64 * 1024)
+
+/*
+ * Start capturing a job's output into an in-memory (memfd) ring buffer
+ * job: The job whose output is captured
+ * pipe_fd: Read end of the pipe the job's stdout and stderr were connected to.
+ *          The job takes ownership of this descriptor, even on error.
+ * Returns 0 on success or -1 on error
+ */
+int job_output_attach(job_t *job, int pipe_fd);
+
+/*
+ * Move all output currently available from a job's pipe into its ring buffer
+ * without blocking. Data is spliced directly from the pipe into the memfd.
+ * Once the job's writers have all exited, its pipe is closed.
+ * job: The job to drain
+ * Returns 0 on success or -1 on error
+ */
+int job_output_drain(job_t *job);
+
+/*
+ * Drain the pipes of every job in a jobs list that captures its output
+ * jobs: The list of current jobs for the shell
+ * Returns 0 on success or -1 on error
+ */
+int job_output_drain_all(job_list_t *jobs);
+
+/*
+ * Write the output retained in a job's ring buffer, oldest byte first
+ * job: The job whose captured output should be written
+ * fd: File descriptor to write the output to
+ * Returns 0 on success or -1 on error
+ */
+int job_output_write(const job_t *job, int fd);
+
+#endif    // JOB_OUTPUT_H
@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+
+#include "job_timer.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "job_list.h"
+
+#define NSEC_PER_SEC 1000000000L
+
+// returns nonzero if time a is strictly before time b
+static int time_before(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// the extra job is ignored if it is also a member of the list
+static job_t *outside_list(job_list_t *jobs, job_t *extra) {
+  for (job_t *current = jobs->head; current != NULL; current = current->next) {
+    if (current == extra) {
+      return NULL;
+    }
+  }
+  return extra;
+}
+
+// signal a job's process group, falling back to the process itself if the
+// child has not yet moved into its own group
+static void signal_job(const job_t *job, int sig) {
+  if (kill(-job->pid, sig) == -1) {
+    if (errno != ESRCH || (kill(job->pid, sig) == -1 && errno != ESRCH)) {
+      perror("kill");
+    }
+  }
+}
+
+// The process groups that have a running (not zombie) member, read from /proc
+// at most once per expiry and only if some job's leader has already exited
+typedef struct {
+  int loaded;    // 1 once read, -1 if reading failed, 0 before
+  pid_t *pgids;
+  size_t len;
+  size_t capacity;
+} group_scan_t;
+
+static int load_running_groups(group_scan_t *scan) {
+  DIR *proc = opendir("/proc");
+  if (proc == NULL) {
+    perror("opendir");
+    return -1;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(proc)) != NULL) {
+    pid_t pid = atoi(entry->d_name);
+    if (pid <= 0) {
+      continue;
+    }
+    char path[64];
+    char buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+      continue;
+    }
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    // "pid (comm) state ppid pgrp ...", comm may itself contain ')'
+    char *fields = strrchr(buf, ')');
+    char state;
+    int ppid;
+    int pgrp;
+    if (fields == NULL || sscanf(fields + 1, " %c %d %d", &state, &ppid, &pgrp) != 3 ||
+        state == 'Z' || state == 'X') {
+      continue;
+    }
+    if (scan->len == scan->capacity) {
+      size_t capacity = scan->capacity == 0 ? 256 : 2 * scan->capacity;
+      pid_t *pgids = realloc(scan->pgids, capacity * sizeof(pid_t));
+      if (pgids == NULL) {
+        perror("realloc");
+        closedir(proc);
+        return -1;
+      }
+      scan->pgids = pgids;
+      scan->capacity = capacity;
+    }
+    scan->pgids[scan->len++] = pgrp;
+  }
+  closedir(proc);
+  return 0;
+}
+
+// returns nonzero if any process of the job's group is still running. An
+// exited leader stays in the group as a zombie until it is reaped (which
+// keeps the group id from being reused), so only its other members count then.
+static int job_running(const job_t *job, group_scan_t *scan) {
+  if (kill(-job->pid, 0) == -1 && errno == ESRCH) {
+    // also covers a child that has not yet moved into its own group
+    return kill(job->pid, 0) == 0;
+  }
+
+  siginfo_t info;
+  info.si_pid = 0;
+  if (waitid(P_PID, job->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+      info.si_pid == 0) {
+    return 1;
+  }
+
+  // the group exists but its leader is a zombie, which kill() can't tell
+  // apart from a running member
+  if (scan->loaded == 0) {
+    scan->loaded = load_running_groups(scan) == -1 ? -1 : 1;
+  }
+  if (scan->loaded == -1) {
+    // assume the worst, the job is checked again later
+    return 1;
+  }
+  for (size_t i = 0; i < scan->len; i++) {
+    if (scan->pgids[i] == job->pid) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void expire_job(job_t *job, const struct timespec *now, group_scan_t *scan) {
+  if (!job_running(job, scan)) {
+    // the whole job finished in time or died of the SIGTERM, so there is
+    // nothing left to enforce and its status is left as it is
+    job->deadline.tv_sec = 0;
+    job->deadline.tv_nsec = 0;
+    return;
+  }
+
+  if (!job->term_sent) {
+    signal_job(job, SIGTERM);
+    signal_job(job, SIGCONT);
+    job->status = TIMED_OUT;
+    job->term_sent = 1;
+  } else {
+    // members that ignore SIGTERM (or whose leader already died of it) are
+    // killed, the job is checked again until its whole group is gone
+    signal_job(job, SIGKILL);
+  }
+  job->deadline = *now;
+  job->deadline.tv_sec += KILL_GRACE_SEC;
+}
+
+int parse_duration(const char *s, struct timespec *duration) {
+  char *end;
+  errno = 0;
+  double secs = strtod(s, &end);
+  if (end == s || errno != 0) {
+    return -1;
+  }
+
+  // optional unit suffix, seconds by default
+  if (strcmp(end, "ms") == 0) {
+    secs /= 1000;
+  } else if (strcmp(end, "m") == 0) {
+    secs *= 60;
+  } else if (strcmp(end, "h") == 0) {
+    secs *= 60 * 60;
+  } else if (strcmp(end, "d") == 0) {
+    secs *= 24 * 60 * 60;
+  } else if (strcmp(end, "") != 0 && strcmp(end, "s") != 0) {
+    return -1;
+  }
+
+  if (!(secs > 0) || secs > (double) INT32_MAX) {
+    return -1;
+  }
+  duration->tv_sec = (time_t) secs;
+  duration->tv_nsec = (long) ((secs - duration->tv_sec) * NSEC_PER_SEC);
+  return 0;
+}
+
+int job_set_timeout(job_t *job, const struct timespec *duration) {
+  if (clock_gettime(CLOCK_MONOTONIC, &job->deadline) == -1) {
+    perror("clock_gettime");
+    return -1;
+  }
+  job->deadline.tv_sec += duration->tv_sec;
+  job->deadline.tv_nsec += duration->tv_nsec;
+  if (job->deadline.tv_nsec >= NSEC_PER_SEC) {
+    job->deadline.tv_sec++;
+    job->deadline.tv_nsec -= NSEC_PER_SEC;
+  }
+  job->term_sent = 0;
+  return 0;
+}
+
+int job_has_deadline(const job_t *job) {
+  return job->deadline.tv_sec != 0 || job->deadline.tv_nsec != 0;
+}
+
+int job_timer_arm(job_list_t *jobs, job_t *extra) {
+  extra = outside_list(jobs, extra);
+
+  // find the earliest deadline, a single timer covers every job
+  const job_t *earliest = NULL;
+  if (extra != NULL && job_has_deadline(extra)) {
+    earliest = extra;
+  }
+  for (job_t *current = jobs->head; current != NULL; current = current->next) {
+    if (job_has_deadline(current) &&
+        (earliest == NULL ||
+         time_before(&current->deadline, &earliest->deadline))) {
+      earliest = current;
+    }
+  }
+
+  if (jobs->timer_fd == -1) {
+    if (earliest == NULL) {
+      return 0;
+    }
+    jobs->timer_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (jobs->timer_fd == -1) {
+      perror("timerfd_create");
+      return -1;
+    }
+  }
+
+  // an all-zero it_value disarms the timer
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (earliest != NULL) {
+    its.it_value = earliest->deadline;
+  }
+  if (timerfd_settime(jobs->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+    perror("timerfd_settime");
+    return -1;
+  }
+  return 0;
+}
+
+int job_timer_expire(job_list_t *jobs, job_t *extra) {
+  if (jobs->timer_fd == -1) {
+    return 0;
+  }
+  extra = outside_list(jobs, extra);
+
+  // drain the expiration count so the timerfd stops polling as readable
+  uint64_t expirations;
+  if (read(jobs->timer_fd, &expirations, sizeof(expirations)) == -1 &&
+      errno != EAGAIN) {
+    perror("read");
+    return -1;
+  }
+
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+    perror("clock_gettime");
+    return -1;
+  }
+
+  group_scan_t scan = {.loaded = 0, .pgids = NULL, .len = 0, .capacity = 0};
+  if (extra != NULL && job_has_deadline(extra) &&
+      !time_before(&now, &extra->deadline)) {
+    expire_job(extra, &now, &scan);
+  }
+  for (job_t *current = jobs->head; current != NULL; current = current->next) {
+    if (job_has_deadline(current) && !time_before(&now, &current->deadline)) {
+      expire_job(current, &now, &scan);
+    }
+  }
+  free(scan.pgids);
+
+  return job_timer_arm(jobs, extra);
+}
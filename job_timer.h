@@ -0,0 +1,59 @@
+#ifndef JOB_TIMER_H
+#define JOB_TIMER_H
+
+#include <time.h>
+
+#include "job_list.h"
+
+// Seconds between a job's SIGTERM on expiry and the follow-up SIGKILL
+#define KILL_GRACE_SEC 2
+
+/*
+ * Parse a duration such as "10", "2.5", "500ms", "3m", "1h" or "1d"
+ * A bare number is interpreted as seconds
+ * s: String to parse
+ * duration: Pointer to timespec in which to store the parsed duration
+ * Returns 0 on success or -1 if 's' is not a positive duration
+ */
+int parse_duration(const char *s, struct timespec *duration);
+
+/*
+ * Give a job a deadline 'duration' from now
+ * The list's timer is not rearmed, call job_timer_arm() afterwards
+ * job: The job to set a deadline for
+ * duration: How long the job may run before it is timed out
+ * Returns 0 on success or -1 on error
+ */
+int job_set_timeout(job_t *job, const struct timespec *duration);
+
+/*
+ * Check whether a job has a pending deadline
+ * job: The job to check
+ * Returns 1 if the job has a deadline or 0 otherwise
+ */
+int job_has_deadline(const job_t *job);
+
+/*
+ * Arm the jobs list's timerfd to fire at the earliest pending deadline among
+ * its jobs, or disarm it if no job has a deadline. The timerfd is only created
+ * once some job actually has a deadline, so jobs->timer_fd may remain -1.
+ * jobs: The list of current jobs for the shell
+ * extra: A job that is not stored in the list (e.g., the foreground job), or NULL
+ * Returns 0 on success or -1 on error
+ */
+int job_timer_arm(job_list_t *jobs, job_t *extra);
+
+/*
+ * Enforce every deadline that has passed, then rearm the timer
+ * On a job's first expiry its process group is sent SIGTERM (and SIGCONT, so
+ * a stopped job can act on it) and the job is marked TIMED_OUT. If the job is
+ * still around KILL_GRACE_SEC seconds later, its process group is sent SIGKILL,
+ * again every KILL_GRACE_SEC seconds until no process of the group is left
+ * running. A job whose processes have all exited only has its deadline cleared.
+ * jobs: The list of current jobs for the shell
+ * extra: A job that is not stored in the list (e.g., the foreground job), or NULL
+ * Returns 0 on success or -1 on error
+ */
+int job_timer_expire(job_list_t *jobs, job_t *extra);
+
+#endif    // JOB_TIMER_H
@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+
+#include "line_edit.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "completion.h"
+#include "job_list.h"
+#include "string_vector.h"
+#include "swish_funcs.h"
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+
+static strvec_t history;    // oldest first
+
+// The terminal's modes before the first line was edited. A line is only
+// edited in raw mode while the terminal is still in these modes, anything
+// else has been set by another program, or by whatever drives the terminal,
+// and is left alone.
+static struct termios cooked;
+static int have_cooked = 0;
+
+// Modes to put back if the shell is killed while a line is being edited
+static struct termios restore_modes;
+
+// Signals that would otherwise leave the terminal in raw mode
+static const int fatal_signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+#define NUM_FATAL_SIGNALS (sizeof(fatal_signals) / sizeof(fatal_signals[0]))
+
+// State of the line being edited
+typedef struct {
+  const char *prompt;
+  char *buf;
+  size_t size;
+  size_t len;
+  size_t pos;                // cursor position in 'buf'
+  unsigned history_idx;      // entry shown, history.length for the new line
+  char *draft;               // the new line, while browsing the history
+} edit_t;
+
+// Put back the terminal's modes, then die from the signal as usual (the
+// handler is installed with SA_RESETHAND)
+static void restore_and_raise(int sig) {
+  tcsetattr(STDIN_FILENO, TCSANOW, &restore_modes);
+  raise(sig);
+}
+
+static int same_modes(const struct termios *a, const struct termios *b) {
+  return a->c_iflag == b->c_iflag && a->c_oflag == b->c_oflag &&
+         a->c_cflag == b->c_cflag && a->c_lflag == b->c_lflag &&
+         memcmp(a->c_cc, b->c_cc, sizeof(a->c_cc)) == 0;
+}
+
+// Check whether something else has set the terminal to echo or assemble lines
+// itself since it was put in raw mode
+static int terminal_took_over(void) {
+  struct termios now;
+  return tcgetattr(STDIN_FILENO, &now) == 0 && (now.c_lflag & (ICANON | ECHO));
+}
+
+static void put(const char *s, size_t n) {
+  while (n > 0) {
+    ssize_t written = write(STDOUT_FILENO, s, n);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    s += written;
+    n -= written;
+  }
+}
+
+static void put_str(const char *s) {
+  put(s, strlen(s));
+}
+
+static void bell(void) {
+  put_str("\a");
+}
+
+// Redraw the prompt and line, then put the cursor back in place
+static void redraw(const edit_t *e) {
+  put_str("\r");
+  put_str(e->prompt);
+  put(e->buf, e->len);
+  put_str("\x1b[K");
+  if (e->pos < e->len) {
+    char move[32];
+    snprintf(move, sizeof(move), "\x1b[%zuD", e->len - e->pos);
+    put_str(move);
+  }
+}
+
+static void insert(edit_t *e, const char *s, size_t n) {
+  if (e->len + n >= e->size) {
+    bell();
+    return;
+  }
+  memmove(e->buf + e->pos + n, e->buf + e->pos, e->len - e->pos);
+  memcpy(e->buf + e->pos, s, n);
+  e->len += n;
+  e->pos += n;
+  if (e->pos == e->len) {
+    put(s, n);
+  } else {
+    redraw(e);
+  }
+}
+
+// Delete the character before the cursor
+static void backspace(edit_t *e) {
+  if (e->pos == 0) {
+    return;
+  }
+  memmove(e->buf + e->pos - 1, e->buf + e->pos, e->len - e->pos);
+  e->pos--;
+  e->len--;
+  if (e->pos == e->len) {
+    put_str("\b \b");
+  } else {
+    redraw(e);
+  }
+}
+
+// Delete the character under the cursor
+static void delete(edit_t *e) {
+  if (e->pos == e->len) {
+    return;
+  }
+  memmove(e->buf + e->pos, e->buf + e->pos + 1, e->len - e->pos - 1);
+  e->len--;
+  redraw(e);
+}
+
+static void replace_line(edit_t *e, const char *s) {
+  e->len = strlen(s) < e->size ? strlen(s) : e->size - 1;
+  memcpy(e->buf, s, e->len);
+  e->pos = e->len;
+  redraw(e);
+}
+
+// Show an older (step -1) or newer (step 1) command from the history
+static void browse_history(edit_t *e, int step) {
+  if ((step < 0 && e->history_idx == 0) ||
+      (step > 0 && e->history_idx == history.length)) {
+    bell();
+    return;
+  }
+  if (e->history_idx == history.length) {
+    free(e->draft);
+    e->buf[e->len] = '\0';
+    e->draft = strdup(e->buf);
+  }
+  e->history_idx += step;
+  if (e->history_idx == history.length) {
+    replace_line(e, e->draft == NULL ? "" : e->draft);
+  } else {
+    replace_line(e, strvec_get(&history, e->history_idx));
+  }
+}
+
+// Print completion candidates below the line, in columns
+static void list_candidates(const completion_t *comp) {
+  struct winsize ws;
+  unsigned width = 80;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+    width = ws.ws_col;
+  }
+  size_t col_width = 0;
+  for (unsigned i = 0; i < comp->shown.length; i++) {
+    size_t len = strlen(strvec_get(&comp->shown, i)) + 2;
+    col_width = len > col_width ? len : col_width;
+  }
+  unsigned per_row = col_width < width ? width / col_width : 1;
+
+  put_str("\n");
+  for (unsigned i = 0; i < comp->shown.length; i++) {
+    const char *name = strvec_get(&comp->shown, i);
+    put_str(name);
+    if ((i + 1) % per_row == 0 || i + 1 == comp->shown.length) {
+      put_str("\n");
+    } else {
+      for (size_t pad = strlen(name); pad < col_width; pad++) {
+        put_str(" ");
+      }
+    }
+  }
+  if (comp->count > comp->shown.length) {
+    char more[64];
+    snprintf(more, sizeof(more), "(%u more)\n", comp->count - comp->shown.length);
+    put_str(more);
+  }
+}
+
+// Complete the word before the cursor, listing the candidates if 'list' is
+// set and the word cannot be extended
+static void complete(edit_t *e, int list) {
+  size_t start = e->pos;
+  while (start > 0 && e->buf[start - 1] != ' ') {
+    start--;
+  }
+  int is_command = 1;
+  for (size_t i = 0; i < start; i++) {
+    is_command &= e->buf[i] == ' ';
+  }
+
+  char word[PATH_MAX];
+  if (e->pos - start >= sizeof(word)) {
+    bell();
+    return;
+  }
+  memcpy(word, e->buf + start, e->pos - start);
+  word[e->pos - start] = '\0';
+
+  completion_t comp;
+  if (complete_word(word, is_command, &comp) == -1) {
+    bell();
+    return;
+  }
+  const char *base = strrchr(word, '/');
+  size_t base_len = strlen(base == NULL ? word : base + 1);
+  size_t common_len = strlen(comp.common);
+
+  if (comp.count == 0) {
+    bell();
+  } else if (common_len > base_len) {
+    insert(e, comp.common + base_len, common_len - base_len);
+  }
+  if (comp.count == 1 && comp.common[common_len - 1] != '/') {
+    insert(e, " ", 1);
+  } else if (comp.count > 1 && common_len == base_len) {
+    if (list) {
+      list_candidates(&comp);
+      redraw(e);
+    } else {
+      bell();
+    }
+  }
+  completion_clear(&comp);
+}
+
+// Read one byte of input, servicing jobs while waiting. Returns 1 on
+// success, 0 at the end of input, or -1 on error
+static int read_key(job_list_t *jobs, unsigned char *c) {
+  if (wait_for_input(jobs) == -1) {
+    return -1;
+  }
+  while (1) {
+    ssize_t n = read(STDIN_FILENO, c, 1);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1) {
+      perror("read");
+    }
+    return n;
+  }
+}
+
+// Handle the rest of an escape sequence such as "ESC [ A" (up arrow)
+static int handle_escape(edit_t *e, job_list_t *jobs) {
+  unsigned char seq[3];
+  if (read_key(jobs, &seq[0]) != 1 || read_key(jobs, &seq[1]) != 1) {
+    return -1;
+  }
+  if (seq[0] != '[' && seq[0] != 'O') {
+    return 0;
+  }
+  switch (seq[1]) {
+    case 'A':
+      browse_history(e, -1);
+      break;
+    case 'B':
+      browse_history(e, 1);
+      break;
+    case 'C':
+      if (e->pos < e->len) {
+        e->pos++;
+        put_str("\x1b[C");
+      }
+      break;
+    case 'D':
+      if (e->pos > 0) {
+        e->pos--;
+        put_str("\x1b[D");
+      }
+      break;
+    case 'H':
+      e->pos = 0;
+      redraw(e);
+      break;
+    case 'F':
+      e->pos = e->len;
+      redraw(e);
+      break;
+    case '3':    // ESC [ 3 ~ is Delete
+      if (read_key(jobs, &seq[2]) != 1) {
+        return -1;
+      }
+      if (seq[2] == '~') {
+        delete(e);
+      }
+      break;
+  }
+  return 0;
+}
+
+// Read a line without editing it, leaving any echo to the terminal
+static int read_plain(char *buf, size_t size, job_list_t *jobs) {
+  size_t len = 0;
+  while (1) {
+    unsigned char c;
+    int n = read_key(jobs, &c);
+    if (n == -1) {
+      return -1;
+    } else if (n == 0 || c == '\n') {
+      buf[len] = '\0';
+      return n == 0 && len == 0;
+    }
+    if (len + 1 < size) {
+      buf[len++] = c;
+    }
+  }
+}
+
+static int add_history(const char *line) {
+  if (line[0] == '\0' ||
+      (history.length > 0 && strcmp(strvec_get(&history, history.length - 1), line) == 0)) {
+    return 0;
+  }
+  if (history.length == HISTORY_MAX) {
+    strvec_drop(&history, 1);
+  }
+  return strvec_add(&history, line);
+}
+
+int line_edit_read(const char *prompt, char *buf, size_t size, job_list_t *jobs) {
+  const char *term = getenv("TERM");
+  struct termios current;
+  if (term == NULL || strcmp(term, "dumb") == 0 ||
+      tcgetattr(STDIN_FILENO, &current) == -1) {
+    // a terminal without cursor control, or not a terminal after all
+    return read_plain(buf, size, jobs);
+  }
+  if (!have_cooked) {
+    cooked = current;
+    have_cooked = 1;
+  }
+  if (!same_modes(&current, &cooked)) {
+    // editing now would echo on top of the terminal, or echo what it hides
+    return read_plain(buf, size, jobs);
+  }
+
+  restore_modes = current;
+  struct sigaction restore = {.sa_handler = restore_and_raise,
+                              .sa_flags = SA_RESETHAND};
+  sigemptyset(&restore.sa_mask);
+  struct sigaction old_actions[NUM_FATAL_SIGNALS];
+  for (unsigned i = 0; i < NUM_FATAL_SIGNALS; i++) {
+    if (sigaction(fatal_signals[i], &restore, &old_actions[i]) == -1) {
+      perror("sigaction");
+      while (i-- > 0) {
+        sigaction(fatal_signals[i], &old_actions[i], NULL);
+      }
+      return -1;
+    }
+  }
+
+  struct termios raw = current;
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  int ret = 0;
+  if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == -1) {
+    perror("tcsetattr");
+    ret = -1;
+  }
+
+  edit_t e = {.prompt = prompt,
+              .buf = buf,
+              .size = size,
+              .len = 0,
+              .pos = 0,
+              .history_idx = history.length,
+              .draft = NULL};
+  unsigned char last = 0;
+  int took_over = 0;
+  while (ret == 0) {
+    unsigned char c;
+    int n = read_key(jobs, &c);
+    if (n != 1) {
+      ret = n == 0 ? 1 : -1;
+      break;
+    }
+
+    // once the terminal echoes by itself, editing would echo twice, so the
+    // rest of the line is taken as it comes
+    took_over = took_over || terminal_took_over();
+    if (took_over) {
+      if (c == '\n' || c == '\r') {
+        break;
+      } else if (e.len + 1 < e.size) {
+        e.buf[e.len++] = c;
+      }
+      continue;
+    }
+
+    if (c == '\n' || c == '\r') {
+      put_str("\n");
+      break;
+    } else if (c == KEY_CTRL('D')) {
+      if (e.len == 0) {
+        ret = 1;
+        break;
+      }
+      delete(&e);
+    } else if (c == KEY_CTRL('C')) {
+      put_str("^C\n");
+      put_str(prompt);
+      e.len = e.pos = 0;
+      e.history_idx = history.length;
+    } else if (c == '\t') {
+      complete(&e, last == '\t');
+    } else if (c == KEY_BACKSPACE || c == KEY_CTRL('H')) {
+      backspace(&e);
+    } else if (c == KEY_CTRL('A')) {
+      e.pos = 0;
+      redraw(&e);
+    } else if (c == KEY_CTRL('E')) {
+      e.pos = e.len;
+      redraw(&e);
+    } else if (c == KEY_CTRL('U')) {
+      e.len = e.pos = 0;
+      redraw(&e);
+    } else if (c == KEY_ESC) {
+      if (handle_escape(&e, jobs) == -1) {
+        ret = -1;
+        break;
+      }
+    } else if (c >= ' ') {
+      insert(&e, (const char *) &c, 1);
+    }
+    last = c;
+  }
+
+  buf[e.len] = '\0';
+  free(e.draft);
+  if (tcsetattr(STDIN_FILENO, TCSANOW, &current) == -1) {
+    perror("tcsetattr");
+    ret = -1;
+  }
+  for (unsigned i = 0; i < NUM_FATAL_SIGNALS; i++) {
+    sigaction(fatal_signals[i], &old_actions[i], NULL);
+  }
+  if (ret == -1) {
+    return -1;
+  }
+  if (ret == 0 && add_history(buf) == -1) {
+    return -1;
+  }
+  return ret;
+}
+
+void line_edit_free(void) {
+  strvec_clear(&history);
+  completion_free();
+  // The editor echoes each line itself just before the shell acts on it, so
+  // the shell may exit right after echoing "exit". A pty hands output to the
+  // terminal side from a kernel worker, and on a single CPU that worker may
+  // not have run before the pty is closed, leaving a reader that stops at the
+  // hangup without the final line. Let it run first.
+  if (have_cooked) {
+    sched_yield();
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef LINE_EDIT_H
+#define LINE_EDIT_H
+
+#include <stddef.h>
+
+#include "job_list.h"
+
+// Number of previous commands kept for recall with the arrow keys
+#define HISTORY_MAX 500
+
+/*
+ * Read a command line from the terminal on stdin, with the terminal in raw
+ * mode so the line can be edited as it is typed:
+ *   Left/Right, Home/End (or ^A/^E)   move the cursor
+ *   Backspace, Delete, ^U             delete a character or the whole line
+ *   Up/Down                           recall previous commands
+ *   Tab                               complete the word before the cursor
+ *                                     (see completion.h), a second Tab lists
+ *                                     the candidates if there are several
+ *   ^C                                discard the line
+ *   ^D                                end of input, on an empty line
+ * Job deadlines and background output are serviced while waiting for keys.
+ * The terminal is restored before returning, or if the shell is killed by a
+ * signal in the meantime.
+ * The line is read as the terminal delivers it, without editing, if $TERM is
+ * unset or "dumb", or if the terminal's modes are no longer the ones it had
+ * before the first line (e.g., another program has turned echo off).
+ * prompt: The prompt, which the caller has already printed
+ * buf: Buffer in which to store the line, without a trailing newline
+ * size: Size of 'buf'
+ * jobs: Pointer to the list of current jobs for the shell
+ * Returns 0 on success, 1 at the end of input, or -1 on error
+ */
+int line_edit_read(const char *prompt, char *buf, size_t size, job_list_t *jobs);
+
+/*
+ * Free the command history and any cached completion candidates, at the end
+ * of an interactive session
+ */
+void line_edit_free(void);
+
+#endif    // LINE_EDIT_H
@@ -0,0 +1,486 @@
+#define _GNU_SOURCE
+
+#include "result_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sha256.h"
+#include "string_vector.h"
+#include "swish_funcs.h"
+
+// Each entry starts with a fixed-size header holding the exit status and the
+// full key, followed by the command's stdout. Entries are named after the
+// start of their key, so the key in the header tells whether an entry really
+// belongs to a command.
+#define CACHE_HEADER_FMT "swish-cache-v2 %03d %64s\n"
+#define CACHE_HEADER_LEN 84
+#define KEY_LEN (2 * SHA256_LEN)
+#define ENTRY_NAME_LEN 16
+
+// Environment variables whose values commonly change a program's output,
+// every LC_* locale variable is also part of the key
+static const char *cache_env_vars[] = {
+    "PATH", "LANG", "TZ",
+};
+
+typedef struct {
+  char name[NAME_MAX + 1];
+  off_t size;
+  struct timespec mtime;
+} cache_entry_t;
+
+// includes the terminating '\0' so consecutive strings can't run together
+static void hash_str(sha256_t *ctx, const char *s) {
+  sha256_update(ctx, s, strlen(s) + 1);
+}
+
+static int hash_file(sha256_t *ctx, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror("Failed to open input file");
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    perror("fstat");
+    close(fd);
+    return -1;
+  }
+
+  sha256_update(ctx, &st.st_size, sizeof(st.st_size));
+  if (st.st_size > 0) {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    sha256_update(ctx, data, st.st_size);
+    munmap(data, st.st_size);
+  }
+  close(fd);
+  return 0;
+}
+
+// Hash what an argument naming an existing file refers to: a regular file's
+// contents, or else its size and modification time (e.g., a directory's
+// mtime changes as entries come and go). Other arguments add nothing.
+static int hash_file_arg(sha256_t *ctx, const char *path) {
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    return 0;
+  }
+  if (S_ISREG(st.st_mode)) {
+    return hash_file(ctx, path);
+  }
+  sha256_update(ctx, &st.st_size, sizeof(st.st_size));
+  sha256_update(ctx, &st.st_mtim, sizeof(st.st_mtim));
+  return 0;
+}
+
+static int compare_strs(const void *a, const void *b) {
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Hash every "LC_*=value" entry of the environment, sorted so that the order
+// in which they were set doesn't matter
+static int hash_locale_vars(sha256_t *ctx) {
+  unsigned num_vars = 0;
+  for (char **var = environ; *var != NULL; var++) {
+    num_vars += strncmp(*var, "LC_", 3) == 0;
+  }
+  if (num_vars == 0) {
+    return 0;
+  }
+
+  char **vars = malloc(num_vars * sizeof(char *));
+  if (vars == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  unsigned i = 0;
+  for (char **var = environ; *var != NULL; var++) {
+    if (strncmp(*var, "LC_", 3) == 0) {
+      vars[i++] = *var;
+    }
+  }
+  qsort(vars, num_vars, sizeof(char *), compare_strs);
+  for (i = 0; i < num_vars; i++) {
+    hash_str(ctx, vars[i]);
+  }
+  free(vars);
+  return 0;
+}
+
+// Compute the store key of a command, a SHA-256 digest, as KEY_LEN hex digits
+static int cache_key(const strvec_t *tokens, char *key) {
+  sha256_t ctx;
+  sha256_init(&ctx);
+
+  // program and arguments, up to the first redirection
+  int redirect_idx = find_redirection(tokens);
+  unsigned num_args = redirect_idx == -1 ? tokens->length : redirect_idx;
+  for (unsigned i = 0; i < num_args; i++) {
+    hash_str(&ctx, strvec_get(tokens, i));
+  }
+  hash_str(&ctx, "");
+
+  // relative paths in arguments resolve against the working directory
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, PATH_MAX) == NULL) {
+    perror("getcwd");
+    return -1;
+  }
+  hash_str(&ctx, cwd);
+
+  for (int i = 0; i < sizeof(cache_env_vars) / sizeof(char *); i++) {
+    const char *value = getenv(cache_env_vars[i]);
+    hash_str(&ctx, cache_env_vars[i]);
+    hash_str(&ctx, value == NULL ? "" : value);
+  }
+  if (hash_locale_vars(&ctx) == -1) {
+    return -1;
+  }
+
+  // files named by arguments, which the command may read, though the program
+  // itself is not an input
+  for (unsigned i = 1; i < num_args; i++) {
+    if (hash_file_arg(&ctx, strvec_get(tokens, i)) == -1) {
+      return -1;
+    }
+  }
+
+  // contents of every file the command reads its input from
+  for (unsigned i = 0; i + 1 < tokens->length; i++) {
+    if (strcmp(strvec_get(tokens, i), "<") == 0 &&
+        hash_file(&ctx, strvec_get(tokens, i + 1)) == -1) {
+      return -1;
+    }
+  }
+
+  unsigned char digest[SHA256_LEN];
+  sha256_final(&ctx, digest);
+  for (unsigned i = 0; i < SHA256_LEN; i++) {
+    snprintf(key + 2 * i, 3, "%02x", digest[i]);
+  }
+  return 0;
+}
+
+// Create a directory along with any missing parents
+static int make_dirs(char *path) {
+  for (char *p = path + 1; *p != '\0'; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      int ret = mkdir(path, S_IRWXU);
+      *p = '/';
+      if (ret == -1 && errno != EEXIST) {
+        perror("mkdir");
+        return -1;
+      }
+    }
+  }
+  if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST) {
+    perror("mkdir");
+    return -1;
+  }
+  return 0;
+}
+
+static int cache_dir(char *dir) {
+  const char *env_dir = getenv("SWISH_CACHE_DIR");
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (env_dir != NULL && env_dir[0] != '\0') {
+    snprintf(dir, PATH_MAX, "%s", env_dir);
+  } else if (xdg != NULL && xdg[0] != '\0') {
+    snprintf(dir, PATH_MAX, "%s/swish", xdg);
+  } else if (home != NULL) {
+    snprintf(dir, PATH_MAX, "%s/.cache/swish", home);
+  } else {
+    fprintf(stderr, "cached: no cache directory, set SWISH_CACHE_DIR\n");
+    return -1;
+  }
+  return make_dirs(dir);
+}
+
+// Check that a cache entry holds the result of the command with key 'key'.
+// Returns 1 and sets 'status' to the stored exit status if it does, or 0 if
+// the entry is for another command (whose key starts the same), is in an
+// older format or is truncated.
+static int check_entry(int fd, const char *key, int *status) {
+  char header[CACHE_HEADER_LEN + 1];
+  char entry_key[KEY_LEN + 1];
+  if (pread(fd, header, CACHE_HEADER_LEN, 0) != CACHE_HEADER_LEN) {
+    return 0;
+  }
+  header[CACHE_HEADER_LEN] = '\0';
+  return sscanf(header, CACHE_HEADER_FMT, status, entry_key) == 2 &&
+         strcmp(entry_key, key) == 0;
+}
+
+// Replay a cache entry's stdout, returning 0 on success or -1 on error
+static int replay(int fd) {
+  // copy in the kernel when stdout allows it, otherwise through a buffer
+  off_t off = CACHE_HEADER_LEN;
+  ssize_t n;
+  while ((n = sendfile(STDOUT_FILENO, fd, &off, 1 << 20)) > 0) {
+  }
+  if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+    char buf[4096];
+    while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+      if (write_all(STDOUT_FILENO, buf, n) == -1) {
+        return -1;
+      }
+      off += n;
+    }
+  }
+  if (n == -1) {
+    perror("replay");
+    return -1;
+  }
+  return 0;
+}
+
+static int compare_mtime(const void *a, const void *b) {
+  const struct timespec *ta = &((const cache_entry_t *) a)->mtime;
+  const struct timespec *tb = &((const cache_entry_t *) b)->mtime;
+  if (ta->tv_sec != tb->tv_sec) {
+    return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  }
+  if (ta->tv_nsec != tb->tv_nsec) {
+    return ta->tv_nsec < tb->tv_nsec ? -1 : 1;
+  }
+  return 0;
+}
+
+// Remove the least recently used entries (by mtime, which is refreshed on
+// every hit) until the store is no larger than its size bound
+static void evict(const char *dir) {
+  off_t max_bytes = CACHE_MAX_BYTES;
+  const char *max_env = getenv("SWISH_CACHE_MAX");
+  if (max_env != NULL) {
+    char *end;
+    errno = 0;
+    long long max = strtoll(max_env, &end, 10);
+    if (errno == 0 && end != max_env && *end == '\0' && max >= 0) {
+      max_bytes = max;
+    } else {
+      fprintf(stderr, "cached: invalid SWISH_CACHE_MAX '%s', using %d\n", max_env,
+              CACHE_MAX_BYTES);
+    }
+  }
+
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    perror("opendir");
+    return;
+  }
+  cache_entry_t *entries = NULL;
+  unsigned num_entries = 0;
+  unsigned capacity = 0;
+  off_t total = 0;
+
+  struct dirent *dent;
+  while ((dent = readdir(d)) != NULL) {
+    // skip ".", ".." and in-progress temporary files
+    struct stat st;
+    if (dent->d_name[0] == '.' ||
+        fstatat(dirfd(d), dent->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (num_entries == capacity) {
+      capacity = capacity == 0 ? 64 : 2 * capacity;
+      cache_entry_t *new_entries =
+          realloc(entries, capacity * sizeof(cache_entry_t));
+      if (new_entries == NULL) {
+        perror("realloc");
+        break;
+      }
+      entries = new_entries;
+    }
+    snprintf(entries[num_entries].name, NAME_MAX + 1, "%s", dent->d_name);
+    entries[num_entries].size = st.st_size;
+    entries[num_entries].mtime = st.st_mtim;
+    num_entries++;
+    total += st.st_size;
+  }
+
+  if (total > max_bytes) {
+    qsort(entries, num_entries, sizeof(cache_entry_t), compare_mtime);
+    for (unsigned i = 0; i < num_entries && total > max_bytes; i++) {
+      if (unlinkat(dirfd(d), entries[i].name, 0) == 0) {
+        total -= entries[i].size;
+      }
+    }
+  }
+  free(entries);
+  closedir(d);
+}
+
+// Run the command, passing its stdout through while recording it into a new
+// entry at 'entry_path'. Returns the command's exit status, or -1 on error.
+static int record(strvec_t *tokens, const char *key, const char *dir,
+                  const char *entry_path) {
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, PATH_MAX, "%s/.tmp-XXXXXX", dir);
+  int tmp_fd = mkstemp(tmp_path);
+  if (tmp_fd == -1) {
+    perror("mkstemp");
+    return -1;
+  }
+
+  int out_pipe[2];
+  if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+    perror("pipe2");
+    close(tmp_fd);
+    unlink(tmp_path);
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    close(tmp_fd);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  if (pid == 0) {
+    // child process, stays in the job's process group
+    if (dup2(out_pipe[1], STDOUT_FILENO) == -1) {
+      perror("dup2");
+      exit(1);
+    }
+    exec_command(tokens);
+    exit(1);
+  }
+
+  // output goes to stdout as it arrives, so caching doesn't delay it
+  close(out_pipe[1]);
+  int ok = lseek(tmp_fd, CACHE_HEADER_LEN, SEEK_SET) != -1;
+  int out_ok = 1;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(out_pipe[0], buf, sizeof(buf))) != 0) {
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("read");
+      ok = 0;
+      break;
+    }
+    // a closed stdout doesn't stop the command, its result is still stored
+    if (out_ok && write_all(STDOUT_FILENO, buf, n) == -1) {
+      out_ok = 0;
+    }
+    if (ok && write_all(tmp_fd, buf, n) == -1) {
+      ok = 0;
+    }
+  }
+  close(out_pipe[0]);
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      perror("waitpid");
+      close(tmp_fd);
+      unlink(tmp_path);
+      return -1;
+    }
+  }
+
+  // only results of commands that ran to completion are worth replaying
+  int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  char header[CACHE_HEADER_LEN + 1];
+  snprintf(header, sizeof(header), CACHE_HEADER_FMT, exit_status, key);
+  if (ok && exit_status != -1 &&
+      pwrite(tmp_fd, header, CACHE_HEADER_LEN, 0) == CACHE_HEADER_LEN &&
+      rename(tmp_path, entry_path) == 0) {
+    close(tmp_fd);
+    evict(dir);
+  } else {
+    close(tmp_fd);
+    unlink(tmp_path);
+  }
+
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return exit_status;
+}
+
+int run_cached(strvec_t *tokens) {
+  // the wrapper leads the job's process group, like run_command() would
+  if (setpgid(0, 0) == -1) {
+    perror("setpgid");
+    return -1;
+  }
+
+  strvec_drop(tokens, 1);
+  if (tokens->length == 0) {
+    fprintf(stderr, "Usage: cached <command>\n");
+    return -1;
+  }
+
+  // a substitution's output can't be known without running it, so the
+  // command runs uncached
+  for (unsigned i = 0; i < tokens->length; i++) {
+    if (is_substitution(strvec_get(tokens, i))) {
+      exec_command(tokens);
+      return -1;
+    }
+  }
+
+  char key[KEY_LEN + 1];
+  char dir[PATH_MAX];
+  char entry_path[PATH_MAX];
+  if (cache_key(tokens, key) == -1 || cache_dir(dir) == -1) {
+    return -1;
+  }
+  if (snprintf(entry_path, PATH_MAX, "%s/%.*s", dir, ENTRY_NAME_LEN, key) >= PATH_MAX) {
+    fprintf(stderr, "cached: cache directory path too long\n");
+    return -1;
+  }
+
+  // redirections apply to the replayed or recorded output alike
+  if (apply_redirections(tokens) == -1) {
+    return -1;
+  }
+  int redirect_idx = find_redirection(tokens);
+  if (redirect_idx != -1) {
+    strvec_take(tokens, redirect_idx);
+  }
+
+  // an entry for another command is replaced by this one's result
+  int status;
+  int fd = open(entry_path, O_RDONLY | O_CLOEXEC);
+  if (fd != -1 && check_entry(fd, key, &status)) {
+    // a hit makes the entry the most recently used one
+    futimens(fd, NULL);
+    if (replay(fd) == -1) {
+      status = -1;
+    }
+  } else {
+    status = record(tokens, key, dir, entry_path);
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return status;
+}
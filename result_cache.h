@@ -0,0 +1,36 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "string_vector.h"
+
+// Default bound on the total size of the cache store, in bytes. It can be
+// overridden with the SWISH_CACHE_MAX environment variable, a non-negative
+// byte count.
+#define CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+/*
+ * Run a "cached" command: "cached <command>"
+ * The command's result is looked up in a content-addressed store, keyed by a
+ * SHA-256 digest of its arguments, the working directory, the environment
+ * variables that commonly affect program output (PATH, LANG, TZ and every LC_*
+ * variable), and the contents of its "<" input files. Every argument after the program that
+ * names an existing file adds that file's contents to the key, or its size
+ * and modification time if it is not a regular file (e.g., a directory). A
+ * command with a process substitution always runs, uncached, since the
+ * substitution's output is unknown beforehand. On a hit, the stored stdout
+ * and exit status are replayed without running anything, so the command's
+ * side effects (e.g., files it writes) are skipped: only commands whose
+ * results are their stdout and exit status should be cached. On a miss, the
+ * command runs and its stdout and exit status are recorded. stderr is never
+ * cached. The least recently used entries are evicted once the store grows
+ * past its size bound.
+ * The store lives in $SWISH_CACHE_DIR, or else in $XDG_CACHE_HOME/swish or
+ * $HOME/.cache/swish.
+ * Like run_command(), this should be called within a CHILD process of the
+ * shell.
+ * tokens: Tokens input by user into shell, starting with "cached"
+ * Returns the command's exit status, or -1 on error
+ */
+int run_cached(strvec_t *tokens);
+
+#endif    // RESULT_CACHE_H
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+
+#include "script_run.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "job_list.h"
+#include "job_timer.h"
+#include "string_vector.h"
+#include "swish_funcs.h"
+
+// A line of the script that runs as a child process
+typedef struct {
+  strvec_t tokens;            // command, without any "timeout" prefix or "&"
+  struct timespec timeout;    // {0, 0} if the line has no deadline
+  strvec_t reads;             // files the line only reads
+  strvec_t writes;            // files the line may modify
+  int pending;                // unfinished earlier lines this line depends on
+  pid_t pid;                  // -1 until the line is started
+  int out_fd;                 // memfd holding the line's stdout and stderr
+  int done;
+} line_t;
+
+// "./out.txt" and "out.txt" name the same file
+static const char *normalize_path(const char *path) {
+  while (path[0] == '.' && path[1] == '/' && path[2] != '\0') {
+    path += 2;
+  }
+  return path;
+}
+
+// options and plain numbers are assumed not to name files
+static int may_be_path(const char *token) {
+  if (token[0] == '-') {
+    return 0;
+  }
+  for (const char *c = token; *c != '\0'; c++) {
+    if (!isdigit((unsigned char) *c)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Record the files read and written by the arguments of a command from
+// index 'first' onwards, including those of its process substitutions
+static int classify_tokens(line_t *line, strvec_t *tokens, unsigned first) {
+  for (unsigned i = first; i < tokens->length; i++) {
+    const char *token = strvec_get(tokens, i);
+    int ret = 0;
+    if (strcmp(token, "<") == 0 && i + 1 < tokens->length) {
+      ret = strvec_add(&line->reads, normalize_path(strvec_get(tokens, ++i)));
+    } else if ((strcmp(token, ">") == 0 || strcmp(token, ">>") == 0) &&
+               i + 1 < tokens->length) {
+      ret = strvec_add(&line->writes, normalize_path(strvec_get(tokens, ++i)));
+    } else if (is_substitution(token)) {
+      char *cmd = strndup(token + 2, strlen(token) - 3);
+      strvec_t inner;
+      if (cmd == NULL || strvec_init(&inner) == -1) {
+        free(cmd);
+        return -1;
+      }
+      ret = tokenize(cmd, &inner) == -1 ? -1 : classify_tokens(line, &inner, 1);
+      strvec_clear(&inner);
+      free(cmd);
+    } else if (may_be_path(token)) {
+      ret = strvec_add(&line->writes, normalize_path(token));
+    }
+    if (ret == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Record the files a line reads and writes
+static int classify_paths(line_t *line) {
+  // the program itself (or the one a "cached" prefix runs) is not an input
+  unsigned first = strcmp(strvec_get(&line->tokens, 0), "cached") == 0 ? 2 : 1;
+  return classify_tokens(line, &line->tokens, first);
+}
+
+// returns nonzero if any path in 'a' is also in 'b'
+static int shares_path(const strvec_t *a, const strvec_t *b) {
+  for (unsigned i = 0; i < a->length; i++) {
+    if (strvec_find(b, strvec_get(a, i)) != -1) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// returns nonzero if 'b' has to wait for the earlier line 'a'
+static int depends_on(const line_t *b, const line_t *a) {
+  return shares_path(&a->writes, &b->reads) || shares_path(&a->writes, &b->writes) ||
+         shares_path(&a->reads, &b->writes);
+}
+
+static void line_free(line_t *line) {
+  strvec_clear(&line->tokens);
+  strvec_clear(&line->reads);
+  strvec_clear(&line->writes);
+  if (line->out_fd != -1) {
+    close(line->out_fd);
+  }
+}
+
+// Fork a child for a line with stdout and stderr going to the line's memfd
+static int start_line(line_t *line, job_list_t *running, const sigset_t *old_mask) {
+  line->out_fd = memfd_create("swish-script-line", MFD_CLOEXEC);
+  if (line->out_fd == -1) {
+    perror("memfd_create");
+    return -1;
+  }
+
+  // the shell blocks SIGCHLD while running lines, the command must not. Its
+  // process group lets a deadline signal the whole line.
+  spawn_opts_t opts = {.null_stdin = 1,
+                       .out_fd = line->out_fd,
+                       .err_fd = line->out_fd,
+                       .mask = old_mask,
+                       .close_fds = 0,
+                       .timeout = NULL,
+                       .output_pipe = -1,
+                       .builtin = NULL,
+                       .shell = NULL};
+  if (line->timeout.tv_sec != 0 || line->timeout.tv_nsec != 0) {
+    opts.timeout = &line->timeout;
+  }
+  line->pid = spawn_job(&line->tokens, &opts, running, BACKGROUND);
+  return line->pid == -1 ? -1 : 0;
+}
+
+// Mark a line as finished, releasing the later lines waiting on it
+static void finish_line(line_t *lines, int num_lines, int idx) {
+  lines[idx].done = 1;
+  for (int i = idx + 1; i < num_lines; i++) {
+    if (depends_on(&lines[i], &lines[idx])) {
+      lines[i].pending--;
+    }
+  }
+}
+
+// Copy a finished line's output to the shell's stdout
+static int print_line(line_t *line) {
+  if (line->out_fd == -1) {
+    return 0;
+  }
+  fflush(stdout);
+  off_t offset = 0;
+  ssize_t n;
+  while ((n = sendfile(STDOUT_FILENO, line->out_fd, &offset, 1 << 20)) > 0 ||
+         (n == -1 && errno == EINTR)) {
+  }
+  if (n == -1 && errno == EINVAL) {
+    // sendfile(2) refuses some outputs (e.g., files opened with O_APPEND)
+    char buf[4096];
+    while ((n = pread(line->out_fd, buf, sizeof(buf), offset)) > 0) {
+      if (write_all(STDOUT_FILENO, buf, n) == -1) {
+        close(line->out_fd);
+        line->out_fd = -1;
+        return -1;
+      }
+      offset += n;
+    }
+  }
+  close(line->out_fd);
+  line->out_fd = -1;
+  if (n == -1) {
+    perror("print_line");
+    return -1;
+  }
+  return 0;
+}
+
+// Reap any lines that have exited, returns the number reaped or -1 on error
+static int reap_lines(line_t *lines, int num_lines, job_list_t *running) {
+  int reaped = 0;
+  for (int i = 0; i < num_lines; i++) {
+    if (lines[i].pid == -1 || lines[i].done) {
+      continue;
+    }
+    int status;
+    pid_t pid = waitpid(lines[i].pid, &status, WNOHANG);
+    if (pid == 0) {
+      continue;
+    } else if (pid == -1) {
+      perror("waitpid");
+      return -1;
+    }
+
+    for (unsigned j = 0; j < running->length; j++) {
+      job_t *job = job_list_get(running, j);
+      if (job->pid == pid) {
+        if (job->status == TIMED_OUT) {
+          dprintf(lines[i].out_fd, "Job timed out\n");
+        }
+        job_list_remove(running, j);
+        break;
+      }
+    }
+    finish_line(lines, num_lines, i);
+    reaped++;
+  }
+  return reaped;
+}
+
+// Run a batch of lines with no barriers between them, honoring their
+// dependencies, and print their output in order
+static int run_lines(line_t *lines, int num_lines, int max_workers) {
+  if (num_lines == 0) {
+    return 0;
+  }
+  for (int i = 0; i < num_lines; i++) {
+    for (int j = 0; j < i; j++) {
+      if (depends_on(&lines[i], &lines[j])) {
+        lines[i].pending++;
+      }
+    }
+  }
+
+  // block SIGCHLD so exits are queued for the signalfd, which is polled
+  // together with the deadline timer of the running lines
+  sigset_t chld_mask, old_mask;
+  if (sigemptyset(&chld_mask) == -1 || sigaddset(&chld_mask, SIGCHLD) == -1) {
+    perror("sigaddset");
+    return -1;
+  }
+  if (sigprocmask(SIG_BLOCK, &chld_mask, &old_mask) == -1) {
+    perror("sigprocmask");
+    return -1;
+  }
+  int sig_fd = signalfd(-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sig_fd == -1) {
+    perror("signalfd");
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return -1;
+  }
+
+  job_list_t running;
+  job_list_init(&running);
+  int num_running = 0;
+  int next_print = 0;
+  int ret = 0;
+  while (next_print < num_lines) {
+    // start ready lines, earliest first
+    for (int i = 0; i < num_lines && num_running < max_workers; i++) {
+      if (lines[i].pid != -1 || lines[i].done || lines[i].pending > 0) {
+        continue;
+      }
+      if (start_line(&lines[i], &running, &old_mask) == -1) {
+        ret = -1;
+        if (lines[i].pid == -1) {
+          // never started, don't hold up the lines that depend on it
+          finish_line(lines, num_lines, i);
+          continue;
+        }
+      }
+      num_running++;
+    }
+
+    int reaped = reap_lines(lines, num_lines, &running);
+    if (reaped == -1) {
+      ret = -1;
+      break;
+    }
+    num_running -= reaped;
+
+    while (next_print < num_lines && lines[next_print].done) {
+      if (print_line(&lines[next_print]) == -1) {
+        ret = -1;
+      }
+      next_print++;
+    }
+
+    if (reaped == 0 && next_print < num_lines) {
+      // checked after blocking SIGCHLD, so no exit can be missed
+      struct pollfd fds[2] = {
+          {.fd = sig_fd, .events = POLLIN},
+          {.fd = running.timer_fd, .events = POLLIN},    // skipped if -1
+      };
+      if (poll(fds, 2, -1) == -1 && errno != EINTR) {
+        perror("poll");
+        ret = -1;
+        break;
+      }
+      struct signalfd_siginfo info;
+      while (read(sig_fd, &info, sizeof(info)) > 0) {
+      }
+      if ((fds[1].revents & POLLIN) && job_timer_expire(&running, NULL) == -1) {
+        ret = -1;
+      }
+    }
+  }
+
+  job_list_free(&running);
+  close(sig_fd);
+  if (sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
+    perror("sigprocmask");
+    return -1;
+  }
+  return ret;
+}
+
+int run_script(const char *path, int max_workers, shell_t *shell) {
+  FILE *script = fopen(path, "r");
+  if (script == NULL) {
+    perror("fopen");
+    return -1;
+  }
+
+  line_t *lines = NULL;
+  int num_lines = 0;
+  int capacity = 0;
+  char *cmd = NULL;
+  size_t cmd_size = 0;
+  int ret = 0;
+  int at_end = 0;
+  while (!at_end && !shell->exiting) {
+    // gather lines up to the next barrier (or the end of the script)
+    strvec_t tokens;
+    strvec_init(&tokens);
+    const builtin_t *barrier = NULL;
+    while (getline(&cmd, &cmd_size, script) != -1) {
+      cmd[strcspn(cmd, "\n")] = '\0';
+      if (tokenize(cmd, &tokens) == -1) {
+        ret = -1;
+        break;
+      }
+      struct timespec timeout;
+      if (tokens.length == 0 || take_timeout(&tokens, &timeout) == -1) {
+        strvec_clear(&tokens);
+        continue;
+      }
+      barrier = builtin_lookup(strvec_get(&tokens, 0));
+      if (barrier != NULL && !(barrier->flags & BUILTIN_CHILD)) {
+        break;
+      }
+      barrier = NULL;
+      if (tokens.length > 1 && strcmp(strvec_get(&tokens, tokens.length - 1), "&") == 0) {
+        strvec_take(&tokens, tokens.length - 1);
+      }
+
+      if (num_lines == capacity) {
+        capacity = capacity == 0 ? 16 : capacity * 2;
+        line_t *grown = realloc(lines, capacity * sizeof(line_t));
+        if (grown == NULL) {
+          perror("realloc");
+          ret = -1;
+          break;
+        }
+        lines = grown;
+      }
+      line_t *line = &lines[num_lines++];
+      line->tokens = tokens;
+      line->timeout = timeout;
+      strvec_init(&line->reads);
+      strvec_init(&line->writes);
+      line->pending = 0;
+      line->pid = -1;
+      line->out_fd = -1;
+      line->done = 0;
+      strvec_init(&tokens);
+      if (classify_paths(line) == -1) {
+        ret = -1;
+        break;
+      }
+    }
+    at_end = barrier == NULL;
+
+    if (ret == 0 && run_lines(lines, num_lines, max_workers) == -1) {
+      ret = -1;
+    }
+    for (int i = 0; i < num_lines; i++) {
+      line_free(&lines[i]);
+    }
+    num_lines = 0;
+
+    if (ret == 0 && barrier != NULL) {
+      run_builtin(barrier, &tokens, shell);
+    }
+    strvec_clear(&tokens);
+    if (ret == -1) {
+      break;
+    }
+  }
+
+  free(cmd);
+  free(lines);
+  fclose(script);
+  fflush(stdout);
+  return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef SCRIPT_RUN_H
+#define SCRIPT_RUN_H
+
+#include "builtins.h"
+
+/*
+ * Run a script of shell commands, one per line, with up to 'max_workers'
+ * lines running at once: "swish -j <workers> <script>"
+ * Lines are ordered by the files they touch. A line waits for every earlier
+ * line that writes a file it reads or writes, or reads a file it writes.
+ * Files written are the ">" and ">>" targets plus any argument that may name
+ * a file (anything other than options and plain numbers), files read are
+ * the "<" targets. Reading a shared file through "<" therefore lets lines run
+ * side by side. Builtins (e.g., cd or wait-all) are barriers: they run in the
+ * shell once every earlier line has finished, and no later line starts
+ * before them.
+ * Each line's stdout and stderr are buffered and printed in script order,
+ * and its stdin is /dev/null, so the output does not depend on scheduling.
+ * A trailing "&" is ignored, and a "timeout" prefix is enforced as usual.
+ * path: Path to the script
+ * max_workers: Maximum number of lines to run concurrently
+ * shell: The shell running the script
+ * Returns 0 on success or -1 on error
+ */
+int run_script(const char *path, int max_workers, shell_t *shell);
+
+#endif    // SCRIPT_RUN_H
@@ -0,0 +1,39 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of a SHA-256 digest, in bytes
+#define SHA256_LEN 32
+
+// State of a SHA-256 hash computed incrementally (FIPS 180-4)
+typedef struct {
+  uint32_t state[8];
+  uint64_t num_bytes;            // total bytes hashed so far
+  unsigned char block[64];       // input not yet hashed, up to one block
+  size_t block_len;
+} sha256_t;
+
+/*
+ * Start a new hash
+ * ctx: The hash state to initialize
+ */
+void sha256_init(sha256_t *ctx);
+
+/*
+ * Add data to a hash
+ * ctx: The hash state
+ * data: Data to hash
+ * len: Number of bytes in 'data'
+ */
+void sha256_update(sha256_t *ctx, const void *data, size_t len);
+
+/*
+ * Finish a hash, after which 'ctx' must be initialized again before reuse
+ * ctx: The hash state
+ * digest: Set to the hash of all the data added to 'ctx'
+ */
+void sha256_final(sha256_t *ctx, unsigned char digest[SHA256_LEN]);
+
+#endif    // SHA256_H
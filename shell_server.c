@@ -0,0 +1,1226 @@
+#define _GNU_SOURCE
+
+#include "shell_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "job_list.h"
+#include "job_output.h"
+#include "job_timer.h"
+#include "string_vector.h"
+#include "swish_funcs.h"
+
+#define MAX_EVENTS 64
+#define LISTEN_BACKLOG 128
+#define READ_CHUNK (64 * 1024)
+// A command's output is no longer read while its client has this much unsent
+#define OUTPUT_HIGH_WATER (1 << 20)
+#define CONNECT_TIMEOUT_MS 2000
+#define CONNECT_RETRY_MS 10
+
+// What a file descriptor registered with epoll belongs to
+typedef enum {
+  SRC_NONE,
+  SRC_LISTEN,
+  SRC_SIGNAL,
+  SRC_JOBS_TIMER,       // deadlines of the shared jobs
+  SRC_RUNNING_TIMER,    // deadlines of the clients' commands
+  SRC_JOB_OUTPUT,       // captured output of a background job
+  SRC_CLIENT,
+  SRC_STDOUT,           // stdout of a client's command
+  SRC_STDERR,           // stderr of a client's command
+} source_kind_t;
+
+typedef struct client {
+  int fd;
+  int cwd_fd;                    // the client's working directory
+  char in[SERVER_LINE_MAX];      // received but not yet run
+  size_t in_len;
+  char *out;                     // frames not yet sent
+  size_t out_len;
+  size_t out_sent;
+  size_t out_cap;
+  uint32_t events;               // events the socket is registered for
+  pid_t pid;                     // the running command, -1 if none
+  int pipes[2];                  // its stdout and stderr, -1 once at EOF
+  int status;                    // its wait status, -1 until it is reaped
+  int paused;                    // 1 while its pipes are not read
+  pid_t wait_pid;                // job awaited with "wait-for", -1 if none
+  int wait_all;                  // 1 while running "wait-all"
+  int eof;                       // 1 once the client sent everything
+  int exiting;                   // 1 once "exit" was run
+  int dirty;                     // 1 if something happened to the client
+  struct client *next;
+} client_t;
+
+typedef struct {
+  source_kind_t kind;
+  uint32_t gen;    // tells a stale event apart from one for a reused fd
+  client_t *client;
+} source_t;
+
+typedef struct {
+  int epoll_fd;
+  int listen_fd;
+  int sig_fd;
+  int base_fd;               // the server's working directory
+  sigset_t old_mask;         // signal mask to restore in children
+  shell_t *shell;
+  job_list_t running;        // the clients' commands, for their deadlines
+  int jobs_timer_fd;         // timerfds registered with epoll, -1 if none
+  int running_timer_fd;
+  source_t *sources;         // indexed by fd
+  int num_sources;
+  client_t *clients;
+  int stopping;
+} server_t;
+
+static int watch(server_t *s, int fd, uint32_t events, source_kind_t kind,
+                 client_t *client) {
+  if (fd >= s->num_sources) {
+    int num = s->num_sources == 0 ? 64 : s->num_sources;
+    while (num <= fd) {
+      num *= 2;
+    }
+    source_t *grown = realloc(s->sources, num * sizeof(source_t));
+    if (grown == NULL) {
+      perror("realloc");
+      return -1;
+    }
+    memset(grown + s->num_sources, 0, (num - s->num_sources) * sizeof(source_t));
+    s->sources = grown;
+    s->num_sources = num;
+  }
+
+  source_t *src = &s->sources[fd];
+  src->gen++;
+  struct epoll_event ev = {.events = events,
+                           .data.u64 = ((uint64_t) src->gen << 32) | (uint32_t) fd};
+  if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  src->kind = kind;
+  src->client = client;
+  return 0;
+}
+
+static void unwatch(server_t *s, int fd) {
+  if (fd < s->num_sources && s->sources[fd].kind != SRC_NONE) {
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    s->sources[fd].kind = SRC_NONE;
+  }
+}
+
+// Register the job lists' timerfds, which are only created once needed
+static void watch_timers(server_t *s) {
+  int jobs_fd = s->shell->jobs.timer_fd;
+  if (jobs_fd != -1 && jobs_fd != s->jobs_timer_fd &&
+      watch(s, jobs_fd, EPOLLIN, SRC_JOBS_TIMER, NULL) == 0) {
+    s->jobs_timer_fd = jobs_fd;
+  }
+  int running_fd = s->running.timer_fd;
+  if (running_fd != -1 && running_fd != s->running_timer_fd &&
+      watch(s, running_fd, EPOLLIN, SRC_RUNNING_TIMER, NULL) == 0) {
+    s->running_timer_fd = running_fd;
+  }
+}
+
+static int append(client_t *c, const void *data, size_t n) {
+  // reclaim the space of sent frames once it is worth the copy
+  if (c->out_sent > 0 && c->out_sent >= c->out_len / 2) {
+    memmove(c->out, c->out + c->out_sent, c->out_len - c->out_sent);
+    c->out_len -= c->out_sent;
+    c->out_sent = 0;
+  }
+  if (c->out_len + n > c->out_cap) {
+    size_t cap = c->out_cap == 0 ? 4096 : c->out_cap;
+    while (cap < c->out_len + n) {
+      cap *= 2;
+    }
+    char *grown = realloc(c->out, cap);
+    if (grown == NULL) {
+      perror("realloc");
+      return -1;
+    }
+    c->out = grown;
+    c->out_cap = cap;
+  }
+  memcpy(c->out + c->out_len, data, n);
+  c->out_len += n;
+  return 0;
+}
+
+static int send_frame(client_t *c, const char *type, const void *data, size_t n) {
+  char header[32];
+  int len = snprintf(header, sizeof(header), "%s %zu\n", type, n);
+  if (append(c, header, len) == -1 || append(c, data, n) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+static int send_text(client_t *c, const char *type, const char *text) {
+  return send_frame(c, type, text, strlen(text));
+}
+
+// Tell the client its command is done, 'status' as returned by waitpid(2)
+static int send_status(client_t *c, int status) {
+  int code = WIFEXITED(status)     ? WEXITSTATUS(status)
+             : WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                   : 128 + WSTOPSIG(status);
+  char frame[32];
+  int len = snprintf(frame, sizeof(frame), "exit %d\n", code);
+  return append(c, frame, len);
+}
+
+// Output the server itself writes for a client, e.g., from a builtin, is
+// collected in a pair of memfds standing in for stdout and stderr
+typedef struct {
+  int fds[2];
+  int saved[2];
+} capture_t;
+
+static int capture_begin(capture_t *cap) {
+  cap->fds[0] = memfd_create("swish-client-stdout", MFD_CLOEXEC);
+  cap->fds[1] = memfd_create("swish-client-stderr", MFD_CLOEXEC);
+  fflush(stdout);
+  fflush(stderr);
+  cap->saved[0] = dup(STDOUT_FILENO);
+  cap->saved[1] = dup(STDERR_FILENO);
+  if (cap->fds[0] == -1 || cap->fds[1] == -1 || cap->saved[0] == -1 ||
+      cap->saved[1] == -1 || dup2(cap->fds[0], STDOUT_FILENO) == -1 ||
+      dup2(cap->fds[1], STDERR_FILENO) == -1) {
+    perror("capture");
+    for (int i = 0; i < 2; i++) {
+      if (cap->saved[i] != -1) {
+        dup2(cap->saved[i], i == 0 ? STDOUT_FILENO : STDERR_FILENO);
+        close(cap->saved[i]);
+      }
+      if (cap->fds[i] != -1) {
+        close(cap->fds[i]);
+      }
+    }
+    return -1;
+  }
+  return 0;
+}
+
+// Restore stdout and stderr, then send what was written to them
+static int capture_end(capture_t *cap, client_t *c) {
+  int ret = 0;
+  fflush(stdout);
+  fflush(stderr);
+  for (int i = 0; i < 2; i++) {
+    if (dup2(cap->saved[i], i == 0 ? STDOUT_FILENO : STDERR_FILENO) == -1) {
+      perror("dup2");
+      ret = -1;
+    }
+    close(cap->saved[i]);
+
+    off_t size = lseek(cap->fds[i], 0, SEEK_END);
+    if (size > 0) {
+      char *data = malloc(size);
+      if (data == NULL || pread(cap->fds[i], data, size, 0) != size ||
+          send_frame(c, i == 0 ? "out" : "err", data, size) == -1) {
+        perror("capture_end");
+        ret = -1;
+      }
+      free(data);
+    }
+    close(cap->fds[i]);
+  }
+  return ret;
+}
+
+static client_t *find_owner(server_t *s, pid_t pid) {
+  for (client_t *c = s->clients; c != NULL; c = c->next) {
+    if (c->pid == pid) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+// Stop or resume reading a command's output, pipes that are not read are
+// left out of epoll entirely so that a hang up on them cannot spin the loop
+static void pause_pipes(server_t *s, client_t *c, int paused) {
+  if (c->paused == paused) {
+    return;
+  }
+  c->paused = paused;
+  for (int i = 0; i < 2; i++) {
+    if (c->pipes[i] == -1) {
+      continue;
+    }
+    if (paused) {
+      unwatch(s, c->pipes[i]);
+    } else {
+      watch(s, c->pipes[i], EPOLLIN, i == 0 ? SRC_STDOUT : SRC_STDERR, c);
+    }
+  }
+}
+
+static void close_pipe(server_t *s, client_t *c, int idx) {
+  if (c->pipes[idx] != -1) {
+    unwatch(s, c->pipes[idx]);
+    close(c->pipes[idx]);
+    c->pipes[idx] = -1;
+  }
+}
+
+// A command is done once it was reaped and all its output was read
+static void try_finish(client_t *c) {
+  if (c->pid != -1 && c->status != -1 && c->pipes[0] == -1 && c->pipes[1] == -1) {
+    send_status(c, c->status);
+    c->pid = -1;
+    c->status = -1;
+  }
+}
+
+static void drop_client(server_t *s, client_t *c) {
+  if (c->pid != -1) {
+    // hang up on the command, as closing its terminal would, it is still
+    // reaped from the running list
+    kill(-c->pid, SIGHUP);
+    kill(-c->pid, SIGCONT);
+  }
+  close_pipe(s, c, 0);
+  close_pipe(s, c, 1);
+  unwatch(s, c->fd);
+  close(c->fd);
+  close(c->cwd_fd);
+  free(c->out);
+
+  client_t **link = &s->clients;
+  while (*link != c) {
+    link = &(*link)->next;
+  }
+  *link = c->next;
+  free(c);
+}
+
+// Start an external command for a client, in the background with "&"
+static void start_command(server_t *s, client_t *c, strvec_t *tokens,
+                          const struct timespec *timeout) {
+  int is_background =
+      tokens->length > 1 && strcmp(strvec_get(tokens, tokens->length - 1), "&") == 0;
+  if (is_background) {
+    strvec_take(tokens, tokens->length - 1);
+  }
+
+  // a command's stdout and stderr are read separately, a captured background
+  // job writes both into one pipe that is drained into the job's buffer
+  int out_pipe[2] = {-1, -1};
+  int err_pipe[2] = {-1, -1};
+  if ((!is_background || s->shell->capture_output) && pipe2(out_pipe, O_CLOEXEC) == -1) {
+    perror("pipe2");
+    send_text(c, "err", "Failed to create pipe\n");
+    send_status(c, 1 << 8);
+    return;
+  }
+  if (!is_background && pipe2(err_pipe, O_CLOEXEC) == -1) {
+    perror("pipe2");
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    send_text(c, "err", "Failed to create pipe\n");
+    send_status(c, 1 << 8);
+    return;
+  }
+  int child_err = is_background ? out_pipe[1] : err_pipe[1];
+
+  // the command gets none of the server's descriptors and signal mask
+  spawn_opts_t opts = {.null_stdin = 1,
+                       .out_fd = out_pipe[1],
+                       .err_fd = child_err,
+                       .mask = &s->old_mask,
+                       .close_fds = 1,
+                       .timeout = timeout,
+                       .output_pipe = is_background ? out_pipe[0] : -1,
+                       .builtin = NULL,
+                       .shell = NULL};
+  job_list_t *jobs = is_background ? &s->shell->jobs : &s->running;
+  pid_t pid = spawn_job(tokens, &opts, jobs, is_background ? BACKGROUND : FOREGROUND);
+  if (out_pipe[1] != -1) {
+    close(out_pipe[1]);
+  }
+  if (err_pipe[1] != -1) {
+    close(err_pipe[1]);
+  }
+  if (pid == -1) {
+    // a background job's output pipe was already closed by spawn_job()
+    if (!is_background) {
+      close(out_pipe[0]);
+      close(err_pipe[0]);
+    }
+    send_text(c, "err", "Failed to start command\n");
+    send_status(c, 1 << 8);
+    return;
+  }
+  if (timeout != NULL) {
+    watch_timers(s);
+  }
+
+  if (is_background) {
+    job_t *job = job_list_get(jobs, jobs->length - 1);
+    if (job->output_pipe != -1) {
+      watch(s, job->output_pipe, EPOLLIN, SRC_JOB_OUTPUT, NULL);
+    }
+    send_status(c, 0);
+    return;
+  }
+
+  c->pid = pid;
+  c->status = -1;
+  c->pipes[0] = out_pipe[0];
+  c->pipes[1] = err_pipe[0];
+  c->paused = 0;
+  for (int i = 0; i < 2; i++) {
+    if (fcntl(c->pipes[i], F_SETFL, O_NONBLOCK) == -1 ||
+        watch(s, c->pipes[i], EPOLLIN, i == 0 ? SRC_STDOUT : SRC_STDERR, c) == -1) {
+      perror("watch");
+    }
+  }
+}
+
+// returns nonzero if a job with the given pid (any job, if -1) still has
+// to be waited for
+static int is_awaitable(job_list_t *jobs, pid_t pid) {
+  for (job_t *job = jobs->head; job != NULL; job = job->next) {
+    if ((pid == -1 || job->pid == pid) &&
+        (job->status == BACKGROUND || job->status == TIMED_OUT)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Reap the shared jobs some client waits for, then complete every wait that
+// is over. Jobs nobody waits for are left alone, as in an interactive shell,
+// so a later "wait-for" from any client still finds them.
+static void reap_jobs(server_t *s) {
+  job_list_t *jobs = &s->shell->jobs;
+  int waiting_all = 0;
+  int waiting = 0;
+  for (client_t *c = s->clients; c != NULL; c = c->next) {
+    waiting_all |= c->wait_all;
+    waiting |= c->wait_all || c->wait_pid != -1;
+  }
+  if (!waiting) {
+    return;
+  }
+
+  unsigned idx = 0;
+  job_t *job = jobs->head;
+  while (job != NULL) {
+    job_t *next = job->next;
+    int awaited = waiting_all;
+    for (client_t *c = s->clients; c != NULL && !awaited; c = c->next) {
+      awaited = c->wait_pid == job->pid;
+    }
+
+    int status;
+    pid_t pid = 0;
+    if (awaited && (job->status == BACKGROUND || job->status == TIMED_OUT)) {
+      pid = waitpid(job->pid, &status, WNOHANG | WUNTRACED);
+      if (pid == -1 && errno != ECHILD) {
+        perror("waitpid");
+        pid = 0;
+      }
+    }
+    if (pid > 0 && WIFSTOPPED(status)) {
+      job->status = STOPPED;
+    } else if (pid != 0) {
+      if (job->output_pipe != -1) {
+        unwatch(s, job->output_pipe);
+      }
+      job_list_remove(jobs, idx);
+      job = next;
+      continue;
+    }
+    idx++;
+    job = next;
+  }
+
+  for (client_t *c = s->clients; c != NULL; c = c->next) {
+    if ((c->wait_pid != -1 && !is_awaitable(jobs, c->wait_pid)) ||
+        (c->wait_all && !is_awaitable(jobs, -1))) {
+      c->wait_pid = -1;
+      c->wait_all = 0;
+      send_status(c, 0);
+      c->dirty = 1;
+    }
+  }
+}
+
+// Start waiting for a job, as "wait-for" does, or for every job
+static void start_wait(server_t *s, client_t *c, strvec_t *tokens) {
+  if (strcmp(strvec_get(tokens, 0), "wait-all") == 0) {
+    c->wait_all = 1;
+    reap_jobs(s);
+    return;
+  }
+
+  int job_num;
+  job_t *job = NULL;
+  if (tokens->length < 2) {
+    send_text(c, "err", "Usage: wait-for <job number>\n");
+  } else if (sscanf(strvec_get(tokens, 1), "%d", &job_num) != 1) {
+    send_text(c, "err", "Invalid job number\n");
+  } else if ((job = job_list_get(&s->shell->jobs, job_num)) == NULL) {
+    send_text(c, "err", "Job index out of bounds\n");
+  } else if (job->status != BACKGROUND && job->status != TIMED_OUT) {
+    send_text(c, "err", "Job index is for stopped process not background process\n");
+    job = NULL;
+  }
+  if (job == NULL) {
+    send_text(c, "out", "Failed to wait for background job\n");
+    send_status(c, 1 << 8);
+    return;
+  }
+  c->wait_pid = job->pid;
+  reap_jobs(s);
+}
+
+static void run_client_builtin(server_t *s, client_t *c, const builtin_t *builtin,
+                               strvec_t *tokens) {
+  // builtins that would block the whole server or need a terminal
+  if (strcmp(builtin->name, "exit") == 0) {
+    c->exiting = 1;
+    send_status(c, 0);
+    return;
+  } else if (strcmp(builtin->name, "wait-for") == 0 ||
+             strcmp(builtin->name, "wait-all") == 0) {
+    start_wait(s, c, tokens);
+    return;
+  } else if (strcmp(builtin->name, "fg") == 0) {
+    send_text(c, "err", "fg: no terminal in server mode, use bg and wait-for\n");
+    send_status(c, 1 << 8);
+    return;
+  }
+
+  capture_t cap;
+  if (capture_begin(&cap) == -1) {
+    send_status(c, 1 << 8);
+    return;
+  }
+  int ret = run_builtin(builtin, tokens, s->shell);
+  capture_end(&cap, c);
+
+  // builtins such as cd move the whole server, only this client moves
+  int cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (cwd_fd == -1) {
+    perror("open");
+  } else {
+    close(c->cwd_fd);
+    c->cwd_fd = cwd_fd;
+  }
+  send_status(c, ret == -1 ? 1 << 8 : 0);
+}
+
+static void handle_line(server_t *s, client_t *c, char *line) {
+  // commands run in the client's working directory
+  if (fchdir(c->cwd_fd) == -1) {
+    perror("fchdir");
+  }
+
+  strvec_t tokens;
+  strvec_init(&tokens);
+  if (tokenize(line, &tokens) != 0) {
+    send_text(c, "err", "Failed to parse command\n");
+    send_status(c, 1 << 8);
+    strvec_clear(&tokens);
+    return;
+  }
+  if (tokens.length == 0) {
+    send_status(c, 0);
+    strvec_clear(&tokens);
+    return;
+  }
+
+  // "timeout <duration> cmd ..." runs cmd with a deadline, its usage errors
+  // go to the client
+  struct timespec timeout;
+  int has_timeout = 0;
+  if (strcmp(strvec_get(&tokens, 0), "timeout") == 0) {
+    capture_t cap;
+    if (capture_begin(&cap) == -1) {
+      has_timeout = -1;
+    } else {
+      has_timeout = take_timeout(&tokens, &timeout);
+      capture_end(&cap, c);
+    }
+  }
+
+  const builtin_t *builtin;
+  if (has_timeout == -1) {
+    send_status(c, 1 << 8);
+  } else if ((builtin = builtin_lookup(strvec_get(&tokens, 0))) != NULL &&
+             !(builtin->flags & BUILTIN_CHILD)) {
+    run_client_builtin(s, c, builtin, &tokens);
+  } else {
+    start_command(s, c, &tokens, has_timeout ? &timeout : NULL);
+  }
+  strvec_clear(&tokens);
+}
+
+// Run the client's received lines, one at a time
+static void run_lines(server_t *s, client_t *c) {
+  while (c->pid == -1 && c->wait_pid == -1 && !c->wait_all && !c->exiting) {
+    char *newline = memchr(c->in, '\n', c->in_len);
+    size_t len;
+    if (newline != NULL) {
+      len = newline - c->in;
+    } else if (c->eof && c->in_len > 0) {
+      len = c->in_len;    // a last line without a newline
+    } else if (c->in_len == sizeof(c->in)) {
+      send_text(c, "err", "Command is too long\n");
+      send_status(c, 1 << 8);
+      c->exiting = 1;
+      return;
+    } else {
+      return;
+    }
+
+    char line[SERVER_LINE_MAX + 1];
+    memcpy(line, c->in, len);
+    line[len] = '\0';
+    size_t consumed = newline != NULL ? len + 1 : len;
+    memmove(c->in, c->in + consumed, c->in_len - consumed);
+    c->in_len -= consumed;
+    handle_line(s, c, line);
+  }
+}
+
+// returns 0 once everything queued was sent or the socket is full, -1 if the
+// client went away
+static int flush_client(server_t *s, client_t *c) {
+  while (c->out_sent < c->out_len) {
+    ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+                     MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (n == -1) {
+      return -1;
+    }
+    c->out_sent += n;
+  }
+  if (c->out_sent == c->out_len) {
+    c->out_sent = c->out_len = 0;
+  }
+  if (c->paused && c->out_len - c->out_sent < OUTPUT_HIGH_WATER / 2) {
+    pause_pipes(s, c, 0);
+  }
+  return 0;
+}
+
+// Make progress on a client after anything happened to it: run its next
+// lines, send its output, and close its connection once it is done. 'c' may
+// have been freed afterwards, but no other client is.
+static void service_client(server_t *s, client_t *c) {
+  run_lines(s, c);
+  if (flush_client(s, c) == -1) {
+    drop_client(s, c);
+    return;
+  }
+
+  int idle = c->pid == -1 && c->wait_pid == -1 && !c->wait_all;
+  int has_line = memchr(c->in, '\n', c->in_len) != NULL;
+  if (idle && c->out_len == 0 && (c->exiting || (c->eof && !has_line))) {
+    drop_client(s, c);
+    return;
+  }
+
+  // lines arriving while the client is busy wait in its buffer, then in the
+  // socket once the buffer is full
+  uint32_t events = 0;
+  if (!c->eof && !c->exiting && c->in_len < sizeof(c->in)) {
+    events |= EPOLLIN;
+  }
+  if (c->out_len > c->out_sent) {
+    events |= EPOLLOUT;
+  }
+  if (events != c->events) {
+    struct epoll_event ev = {.events = events,
+                             .data.u64 = ((uint64_t) s->sources[c->fd].gen << 32) |
+                                         (uint32_t) c->fd};
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+      perror("epoll_ctl");
+    }
+    c->events = events;
+  }
+}
+
+// Service every client marked dirty. Servicing one client can complete
+// another's wait, so this repeats until no client is left dirty.
+static void service_clients(server_t *s) {
+  int again = 1;
+  while (again) {
+    again = 0;
+    client_t *next;
+    for (client_t *c = s->clients; c != NULL; c = next) {
+      next = c->next;
+      if (c->dirty) {
+        c->dirty = 0;
+        again = 1;
+        service_client(s, c);
+      }
+    }
+  }
+}
+
+static void accept_clients(server_t *s) {
+  while (1) {
+    int fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("accept4");
+      }
+      return;
+    }
+
+    // the socket's permissions already keep other users out, but not every
+    // system honors them, so check who connected as well
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 ||
+        cred.uid != geteuid()) {
+      close(fd);
+      continue;
+    }
+
+    client_t *c = calloc(1, sizeof(client_t));
+    if (c == NULL) {
+      perror("calloc");
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->cwd_fd = fcntl(s->base_fd, F_DUPFD_CLOEXEC, 0);
+    c->events = EPOLLIN;
+    c->pid = -1;
+    c->pipes[0] = c->pipes[1] = -1;
+    c->status = -1;
+    c->wait_pid = -1;
+    if (c->cwd_fd == -1 || watch(s, fd, c->events, SRC_CLIENT, c) == -1) {
+      if (c->cwd_fd != -1) {
+        close(c->cwd_fd);
+      }
+      close(fd);
+      free(c);
+      continue;
+    }
+    c->next = s->clients;
+    s->clients = c;
+  }
+}
+
+static void read_client(server_t *s, client_t *c, uint32_t events) {
+  while ((events & EPOLLIN) && !c->eof && c->in_len < sizeof(c->in)) {
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if (n == 0) {
+      c->eof = 1;
+    } else if (n > 0) {
+      c->in_len += n;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      drop_client(s, c);
+      return;
+    }
+  }
+
+  // a client that hung up entirely can't receive anything more, whatever
+  // it sent before has been started
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    run_lines(s, c);
+    drop_client(s, c);
+    return;
+  }
+  c->dirty = 1;
+}
+
+static void read_output(server_t *s, client_t *c, int idx) {
+  char buf[READ_CHUNK];
+  while (c->pipes[idx] != -1 && c->out_len - c->out_sent < OUTPUT_HIGH_WATER) {
+    ssize_t n = read(c->pipes[idx], buf, sizeof(buf));
+    if (n > 0) {
+      send_frame(c, idx == 0 ? "out" : "err", buf, n);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      close_pipe(s, c, idx);
+    } else if (errno == EAGAIN) {
+      break;
+    }
+  }
+  if (c->out_len - c->out_sent >= OUTPUT_HIGH_WATER) {
+    pause_pipes(s, c, 1);
+  }
+  try_finish(c);
+  c->dirty = 1;
+}
+
+// Reap the clients' commands that have exited or stopped
+static void reap_commands(server_t *s) {
+  unsigned idx = 0;
+  job_t *job = s->running.head;
+  while (job != NULL) {
+    job_t *next = job->next;
+    int status;
+    pid_t pid = waitpid(job->pid, &status, WNOHANG | WUNTRACED);
+    if (pid == 0 || (pid == -1 && errno != ECHILD)) {
+      if (pid == -1) {
+        perror("waitpid");
+      }
+      idx++;
+      job = next;
+      continue;
+    }
+    if (pid == -1) {
+      status = 1 << 8;    // reaped elsewhere, nothing to report
+    }
+
+    client_t *c = find_owner(s, job->pid);
+    if (pid > 0 && WIFSTOPPED(status)) {
+      // a stopped command becomes a stopped job that any client can resume
+      // with "bg", its later stdout is captured and its stderr discarded
+      job_list_t *jobs = &s->shell->jobs;
+      if (job_list_add(jobs, job->pid, job->name, STOPPED) == 0) {
+        job_t *stopped = job_list_get(jobs, jobs->length - 1);
+        stopped->deadline = job->deadline;
+        stopped->term_sent = job->term_sent;
+        job_timer_arm(jobs, NULL);
+        watch_timers(s);
+        if (c != NULL && c->pipes[0] != -1) {
+          unwatch(s, c->pipes[0]);
+          if (job_output_attach(stopped, c->pipes[0]) == 0) {
+            watch(s, stopped->output_pipe, EPOLLIN, SRC_JOB_OUTPUT, NULL);
+          }
+          c->pipes[0] = -1;
+        }
+      }
+      if (c != NULL) {
+        close_pipe(s, c, 0);
+        close_pipe(s, c, 1);
+      }
+    } else if (c != NULL && job->status == TIMED_OUT) {
+      send_text(c, "out", "Job timed out\n");
+    }
+    if (c != NULL) {
+      c->status = status;
+    }
+    job_list_remove(&s->running, idx);
+    job = next;
+  }
+
+  for (client_t *c = s->clients; c != NULL; c = c->next) {
+    if (c->pid != -1 && c->status != -1) {
+      try_finish(c);
+      c->dirty = 1;
+    }
+  }
+}
+
+static void handle_signals(server_t *s) {
+  struct signalfd_siginfo info;
+  int child_exited = 0;
+  while (read(s->sig_fd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo == SIGCHLD) {
+      child_exited = 1;
+    } else {
+      s->stopping = 1;
+    }
+  }
+  if (child_exited) {
+    reap_commands(s);
+    reap_jobs(s);
+  }
+}
+
+static void handle_job_output(server_t *s, int fd, uint32_t events) {
+  // the pipe is closed once drained to its end, it has to leave epoll first
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    unwatch(s, fd);
+  }
+  for (job_t *job = s->shell->jobs.head; job != NULL; job = job->next) {
+    if (job->output_pipe == fd) {
+      job_output_drain(job);
+      return;
+    }
+  }
+  unwatch(s, fd);
+}
+
+static void dispatch(server_t *s, const struct epoll_event *ev) {
+  int fd = (int) (uint32_t) ev->data.u64;
+  uint32_t gen = ev->data.u64 >> 32;
+  if (fd >= s->num_sources || s->sources[fd].kind == SRC_NONE ||
+      s->sources[fd].gen != gen) {
+    return;    // the fd was closed by an earlier event in the same batch
+  }
+  source_t *src = &s->sources[fd];
+  switch (src->kind) {
+    case SRC_LISTEN:
+      accept_clients(s);
+      break;
+    case SRC_SIGNAL:
+      handle_signals(s);
+      break;
+    case SRC_JOBS_TIMER:
+      job_timer_expire(&s->shell->jobs, NULL);
+      break;
+    case SRC_RUNNING_TIMER:
+      job_timer_expire(&s->running, NULL);
+      break;
+    case SRC_JOB_OUTPUT:
+      handle_job_output(s, fd, ev->events);
+      break;
+    case SRC_CLIENT:
+      read_client(s, src->client, ev->events);
+      break;
+    case SRC_STDOUT:
+    case SRC_STDERR:
+      read_output(s, src->client, src->kind == SRC_STDOUT ? 0 : 1);
+      break;
+    case SRC_NONE:
+      break;
+  }
+}
+
+// Check whether the socket file at 'addr' was left behind by a server that
+// is gone. Returns 1 if it is stale, or 0 after explaining why it isn't.
+static int is_stale_socket(const struct sockaddr_un *addr) {
+  struct stat st;
+  if (lstat(addr->sun_path, &st) == -1 || !S_ISSOCK(st.st_mode)) {
+    fprintf(stderr, "%s already exists and is not a socket\n", addr->sun_path);
+    return 0;
+  }
+
+  // nothing accepts connections on a stale socket
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return 0;
+  }
+  int ret = connect(fd, (const struct sockaddr *) addr, sizeof(*addr));
+  int connect_errno = errno;
+  close(fd);
+  if (ret == -1 && connect_errno == ECONNREFUSED) {
+    return 1;
+  }
+  fprintf(stderr, "%s is in use by another server\n", addr->sun_path);
+  return 0;
+}
+
+static int open_listener(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path is too long\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+
+  // anyone who can connect can run commands as this user, so the socket is
+  // created accessible to its owner only
+  mode_t old_umask = umask(S_IRWXG | S_IRWXO);
+  int ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+  if (ret == -1 && errno == EADDRINUSE) {
+    if (!is_stale_socket(&addr)) {
+      umask(old_umask);
+      close(fd);
+      return -1;
+    }
+    // left behind by a server that didn't shut down cleanly
+    unlink(path);
+    ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+  }
+  umask(old_umask);
+  if (ret == -1) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, LISTEN_BACKLOG) == -1) {
+    perror("listen");
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  return fd;
+}
+
+int run_server(const char *path, shell_t *shell) {
+  server_t s = {.epoll_fd = -1,
+                .listen_fd = -1,
+                .sig_fd = -1,
+                .base_fd = -1,
+                .shell = shell,
+                .jobs_timer_fd = -1,
+                .running_timer_fd = -1,
+                .sources = NULL,
+                .num_sources = 0,
+                .clients = NULL,
+                .stopping = 0};
+  job_list_init(&s.running);
+
+  // child exits and the signals that stop the server are read from a
+  // signalfd, polled together with everything else
+  sigset_t mask;
+  if (sigemptyset(&mask) == -1 || sigaddset(&mask, SIGCHLD) == -1 ||
+      sigaddset(&mask, SIGINT) == -1 || sigaddset(&mask, SIGTERM) == -1) {
+    perror("sigaddset");
+    return -1;
+  }
+  if (sigprocmask(SIG_BLOCK, &mask, &s.old_mask) == -1) {
+    perror("sigprocmask");
+    return -1;
+  }
+
+  int ret = -1;
+  s.sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  s.base_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (s.sig_fd == -1 || s.epoll_fd == -1 || s.base_fd == -1) {
+    perror("run_server");
+  } else if ((s.listen_fd = open_listener(path)) != -1 &&
+             watch(&s, s.listen_fd, EPOLLIN, SRC_LISTEN, NULL) == 0 &&
+             watch(&s, s.sig_fd, EPOLLIN, SRC_SIGNAL, NULL) == 0) {
+    ret = 0;
+  }
+
+  // there is no terminal to print background output to, and background
+  // builtins get none of the server's descriptors and signal mask
+  shell->capture_output = 1;
+  shell->job_mask = &s.old_mask;
+  shell->isolate_jobs = 1;
+
+  struct epoll_event events[MAX_EVENTS];
+  while (ret == 0 && !s.stopping) {
+    int n = epoll_wait(s.epoll_fd, events, MAX_EVENTS, -1);
+    if (n == -1 && errno != EINTR) {
+      perror("epoll_wait");
+      ret = -1;
+    }
+    for (int i = 0; i < n; i++) {
+      dispatch(&s, &events[i]);
+    }
+    service_clients(&s);
+  }
+
+  while (s.clients != NULL) {
+    drop_client(&s, s.clients);
+  }
+  job_list_free(&s.running);
+  if (s.listen_fd != -1) {
+    close(s.listen_fd);
+    if (unlinkat(s.base_fd, path, 0) == -1) {
+      perror("unlink");
+    }
+  }
+  if (s.base_fd != -1) {
+    if (fchdir(s.base_fd) == -1) {
+      perror("fchdir");
+    }
+    close(s.base_fd);
+  }
+  if (s.epoll_fd != -1) {
+    close(s.epoll_fd);
+  }
+  if (s.sig_fd != -1) {
+    close(s.sig_fd);
+  }
+  free(s.sources);
+  shell->job_mask = NULL;
+  shell->isolate_jobs = 0;
+  if (sigprocmask(SIG_SETMASK, &s.old_mask, NULL) == -1) {
+    perror("sigprocmask");
+    return -1;
+  }
+  return ret;
+}
+
+static int connect_server(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path is too long\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  // the server may still be starting up
+  for (int waited = 0;; waited += CONNECT_RETRY_MS) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+      perror("socket");
+      return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+      return fd;
+    }
+    int err = errno;
+    close(fd);
+    if ((err != ENOENT && err != ECONNREFUSED) || waited >= CONNECT_TIMEOUT_MS) {
+      errno = err;
+      perror("connect");
+      return -1;
+    }
+    struct timespec pause = {0, CONNECT_RETRY_MS * 1000000L};
+    nanosleep(&pause, NULL);
+  }
+}
+
+// Frames received from the server, see run_server()
+typedef struct {
+  char buf[READ_CHUNK];
+  size_t len;
+  size_t payload;    // bytes left in the current "out" or "err" frame
+  int payload_fd;
+  int status;        // from the last "exit" frame
+} replies_t;
+
+// Handle every complete frame header received, and whatever is available of
+// frame payloads, keeping any partial header for later
+static int parse_replies(replies_t *r) {
+  size_t pos = 0;
+  while (pos < r->len) {
+    if (r->payload > 0) {
+      size_t n = r->len - pos < r->payload ? r->len - pos : r->payload;
+      if (write_all(r->payload_fd, r->buf + pos, n) == -1) {
+        return -1;
+      }
+      pos += n;
+      r->payload -= n;
+      continue;
+    }
+
+    char *newline = memchr(r->buf + pos, '\n', r->len - pos);
+    if (newline == NULL) {
+      break;
+    }
+    *newline = '\0';
+    char type[8];
+    long long value;
+    if (sscanf(r->buf + pos, "%7s %lld", type, &value) != 2 || value < 0) {
+      fprintf(stderr, "Malformed reply from server\n");
+      return -1;
+    }
+    if (strcmp(type, "out") == 0 || strcmp(type, "err") == 0) {
+      r->payload = value;
+      r->payload_fd = type[0] == 'o' ? STDOUT_FILENO : STDERR_FILENO;
+    } else if (strcmp(type, "exit") == 0) {
+      r->status = value;
+    }
+    pos = newline + 1 - r->buf;
+  }
+
+  if (pos == 0 && r->len == sizeof(r->buf)) {
+    fprintf(stderr, "Malformed reply from server\n");
+    return -1;
+  }
+  memmove(r->buf, r->buf + pos, r->len - pos);
+  r->len -= pos;
+  return 0;
+}
+
+int run_client(const char *path) {
+  int fd = connect_server(path);
+  if (fd == -1) {
+    return -1;
+  }
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    perror("fcntl");
+    close(fd);
+    return -1;
+  }
+
+  // stdin is only read once the previous chunk was sent, so a busy server
+  // never keeps the client from reading its replies
+  static char in[READ_CHUNK];
+  size_t in_len = 0;
+  size_t in_sent = 0;
+  int stdin_open = 1;
+  static replies_t replies;
+  replies.len = replies.payload = 0;
+  replies.status = 0;
+  int ret = 0;
+  while (1) {
+    struct pollfd fds[2] = {
+        {.fd = stdin_open && in_sent == in_len ? STDIN_FILENO : -1, .events = POLLIN},
+        {.fd = fd, .events = POLLIN | (in_sent < in_len ? POLLOUT : 0)},
+    };
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      ret = -1;
+      break;
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = read(STDIN_FILENO, in, sizeof(in));
+      if (n > 0) {
+        in_len = n;
+        in_sent = 0;
+      } else if (n == 0 || errno != EINTR) {
+        // let the server finish the commands it has, then hang up
+        stdin_open = 0;
+        shutdown(fd, SHUT_WR);
+      }
+    }
+    if (fds[1].revents & POLLOUT) {
+      ssize_t n = send(fd, in + in_sent, in_len - in_sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        in_sent += n;
+      } else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("send");
+        ret = -1;
+        break;
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = recv(fd, replies.buf + replies.len, sizeof(replies.buf) - replies.len, 0);
+      if (n == 0) {
+        break;
+      } else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("recv");
+        ret = -1;
+        break;
+      } else if (n > 0) {
+        replies.len += n;
+        if (parse_replies(&replies) == -1) {
+          ret = -1;
+          break;
+        }
+      }
+    }
+  }
+
+  close(fd);
+  return ret == -1 ? -1 : replies.status;
+}
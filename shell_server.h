@@ -0,0 +1,50 @@
+#ifndef SHELL_SERVER_H
+#define SHELL_SERVER_H
+
+#include "builtins.h"
+
+// Longest command line a client may send, including the newline
+#define SERVER_LINE_MAX 512
+
+/*
+ * Serve shell commands to clients connecting to a Unix domain socket:
+ * "swish --serve <socket>"
+ * Clients send command lines terminated by newlines. Each client's lines run
+ * one after the other, through the same parsing and spawning as typed
+ * commands, while lines from different clients run concurrently. Everything
+ * is driven by a single epoll loop, so a slow command or client holds up no
+ * one else. For every line the server sends back frames of the form:
+ *   "out <n>\n" followed by n bytes the command wrote to stdout
+ *   "err <n>\n" followed by n bytes the command wrote to stderr
+ *   "exit <status>\n" once the command is done (128 + signal if it was
+ *                     killed or stopped)
+ * The job list is shared by all clients: a job started with "&" by one
+ * client can be listed, resumed with "bg" or waited for with "wait-for" by
+ * any other. Waits complete asynchronously, without blocking other clients.
+ * Output of background jobs is captured (see "capture") since there is no
+ * terminal to print it to, and "fg" is unavailable for the same reason.
+ * Each client has its own working directory, which starts out as the
+ * server's. Commands get /dev/null as their stdin. "exit" closes the
+ * client's connection. The server runs until it receives SIGINT or SIGTERM,
+ * then removes the socket.
+ * Only the user running the server may connect: the socket is created with
+ * mode 0600 and clients with another uid are turned away. A socket left at
+ * 'path' by a server that is no longer running is replaced.
+ * path: Path at which to create the socket
+ * shell: The shell whose job list is shared
+ * Returns 0 on success or -1 on error
+ */
+int run_server(const char *path, shell_t *shell);
+
+/*
+ * Send command lines read from stdin to a server started with "--serve" and
+ * copy back the output of each command to stdout and stderr:
+ * "swish --connect <socket>"
+ * Connecting is retried for a short while, so a client may be started
+ * right after the server.
+ * path: Path of the server's socket
+ * Returns the exit status of the last command, or -1 on error
+ */
+int run_client(const char *path);
+
+#endif    // SHELL_SERVER_H
@@ -67,6 +67,21 @@ char *strvec_get(const strvec_t *vec, unsigned i) {
     return vec->data[i];
 }
 
+int strvec_set(strvec_t *vec, unsigned i, const char *s) {
+    if (i >= vec->length) {
+        return -1;
+    }
+
+    char *copy = malloc((strlen(s) + 1) * sizeof(char));
+    if (copy == NULL) {
+        return -1;
+    }
+    strcpy(copy, s);
+    free(vec->data[i]);
+    vec->data[i] = copy;
+    return 0;
+}
+
 int strvec_find(const strvec_t *vec, const char *s) {
     for (int i = 0; i < vec->length; i++) {
         if (strcmp(vec->data[i], s) == 0) {
@@ -86,3 +101,15 @@ void strvec_take(strvec_t *vec, unsigned n) {
     }
     vec->length = n;
 }
+
+void strvec_drop(strvec_t *vec, unsigned n) {
+    if (n > vec->length) {
+        n = vec->length;
+    }
+
+    for (int i = 0; i < n; i++) {
+        free(vec->data[i]);
+    }
+    memmove(vec->data, vec->data + n, (vec->length - n) * sizeof(char *));
+    vec->length -= n;
+}
@@ -42,6 +42,16 @@ int strvec_add(strvec_t *vec, const char *s);
  */
 char *strvec_get(const strvec_t *vec, unsigned i);
 
+/*
+ * Replace an element of a string vector
+ * vec: Pointer to the vector to modify
+ * i: Index of the element to replace (starts at 0)
+ * s: The new string
+ * Returns 0 on success, -1 on error (the old element is kept)
+ * Note: The vector stores its own copy of this string
+ */
+int strvec_set(strvec_t *vec, unsigned i, const char *s);
+
 /*
  * Search for a specific string within a string vector
  * vec: Pointer to the vector to search within
@@ -57,4 +67,12 @@ int strvec_find(const strvec_t *vec, const char *s);
  */
 void strvec_take(strvec_t *vec, unsigned n);
 
+/*
+ * Modify a string vector so that it no longer contains its first 'n' elements
+ * The remaining elements are shifted down to start at index 0
+ * vec: Pointer to string vector to shorten
+ * n: Number of leading elements to remove from the vector
+ */
+void strvec_drop(strvec_t *vec, unsigned n);
+
 #endif    // STRING_VECTOR_H
@@ -1,13 +1,23 @@
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "builtins.h"
 #include "job_list.h"
+#include "job_output.h"
+#include "job_timer.h"
+#include "line_edit.h"
+#include "script_run.h"
+#include "shell_server.h"
 #include "string_vector.h"
 #include "swish_funcs.h"
 
@@ -30,166 +40,197 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // "swish [-j <workers>] <script>" runs a script instead of reading commands,
+  // "swish --serve <socket>" serves commands to clients of a Unix socket and
+  // "swish --connect <socket>" is such a client
+  static const struct option long_options[] = {
+      {"serve", required_argument, NULL, 's'},
+      {"connect", required_argument, NULL, 'c'},
+      {NULL, 0, NULL, 0},
+  };
+  int max_workers = 0;
+  const char *serve_path = NULL;
+  const char *connect_path = NULL;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:", long_options, NULL)) != -1) {
+    if (opt == 's') {
+      serve_path = optarg;
+    } else if (opt == 'c') {
+      connect_path = optarg;
+    } else if (opt != 'j' || sscanf(optarg, "%d", &max_workers) != 1 ||
+               max_workers < 1) {
+      fprintf(stderr, "Usage: %s [-j <workers>] [script]\n", argv[0]);
+      fprintf(stderr, "       %s --serve|--connect <socket>\n", argv[0]);
+      return 1;
+    }
+  }
+  if (max_workers > 0 && optind == argc) {
+    fprintf(stderr, "-j requires a script\n");
+    return 1;
+  }
+  if (connect_path != NULL) {
+    int status = run_client(connect_path);
+    return status == -1 ? 1 : status;
+  }
+
   strvec_t tokens;
   strvec_init(&tokens);
-  job_list_t jobs;
-  job_list_init(&jobs);
+  shell_t shell = {
+      .capture_output = 0, .exiting = 0, .job_mask = NULL, .isolate_jobs = 0};
+  job_list_init(&shell.jobs);
+  if (builtins_init() == -1) {
+    printf("Failed to register builtins\n");
+    return 1;
+  }
+  if (serve_path != NULL) {
+    int ret = run_server(serve_path, &shell);
+    strvec_clear(&tokens);
+    job_list_free(&shell.jobs);
+    builtins_free();
+    return ret == -1;
+  }
+  if (optind < argc) {
+    int ret = run_script(argv[optind], max_workers > 0 ? max_workers : 1, &shell);
+    strvec_clear(&tokens);
+    job_list_free(&shell.jobs);
+    builtins_free();
+    return ret == -1;
+  }
   char cmd[CMD_LEN];
 
   printf("%s", PROMPT);
-  while (fgets(cmd, CMD_LEN, stdin) != NULL) {
+  // an interactive shell edits lines as they are typed and keeps enforcing
+  // job deadlines while idle at the prompt
+  int interactive = isatty(STDIN_FILENO);
+  // a non-interactive shell reads stdin unbuffered, so that no lines sit in
+  // stdio's buffer while wait_for_input() polls the descriptor, and commands
+  // that read stdin get the rest of the input
+  if (!interactive) {
+    setvbuf(stdin, NULL, _IONBF, 0);
+  }
+  while (interactive ? line_edit_read(PROMPT, cmd, CMD_LEN, &shell.jobs) == 0
+                     : wait_for_input(&shell.jobs) == 0 &&
+                           fgets(cmd, CMD_LEN, stdin) != NULL) {
     // Need to remove trailing '\n' from cmd. There are fancier ways.
-    int i = 0;
-    while (cmd[i] != '\n') {
-      i++;
-    }
-    cmd[i] = '\0';
+    cmd[strcspn(cmd, "\n")] = '\0';
+
+    // enforce any deadlines that passed since the last command and pick up
+    // any output background jobs produced in the meantime
+    job_timer_expire(&shell.jobs, NULL);
+    job_output_drain_all(&shell.jobs);
 
     if (tokenize(cmd, &tokens) != 0) {
       printf("Failed to parse command\n");
       strvec_clear(&tokens);
-      job_list_free(&jobs);
+      job_list_free(&shell.jobs);
+      builtins_free();
+      line_edit_free();
       return 1;
     }
     if (tokens.length == 0) {
       printf("%s", PROMPT);
       continue;
     }
-    const char *first_token = strvec_get(&tokens, 0);
-
-    if (strcmp(first_token, "pwd") == 0) {
-      char buf[CMD_LEN];
-      if (getcwd(buf, CMD_LEN) == NULL) {
-        perror("getcwd");
-      } else {
-        printf("%s\n", buf);
-      }
-    }
-
-    else if (strcmp(first_token, "cd") == 0) {
-      // argument for directory to change to
-      const char *second_token = strvec_get(&tokens, 1);
-      const char *dir;
 
-      // if cd is used alone, move to user's home directory
-      if (second_token == NULL) {
-        dir = getenv("HOME");
-      } else {
-        dir = second_token;
-      }
-
-      // change the directory and handle errors accordingly
-      if (chdir(dir) != 0) {
-        perror("chdir");
-      }
-    }
-
-    else if (strcmp(first_token, "exit") == 0) {
+    // "timeout <duration> cmd ..." runs cmd with a deadline
+    struct timespec timeout;
+    int has_timeout = take_timeout(&tokens, &timeout);
+    if (has_timeout == -1) {
       strvec_clear(&tokens);
-      break;
-    }
-
-    // Task 5: Print out current list of pending jobs
-    else if (strcmp(first_token, "jobs") == 0) {
-      int i = 0;
-      job_t *current = jobs.head;
-      while (current != NULL) {
-        char *status_desc;
-        if (current->status == BACKGROUND) {
-          status_desc = "background";
-        } else {
-          status_desc = "stopped";
-        }
-        printf("%d: %s (%s)\n", i, current->name, status_desc);
-        i++;
-        current = current->next;
-      }
+      printf("%s", PROMPT);
+      continue;
     }
+    const builtin_t *builtin = builtin_lookup(strvec_get(&tokens, 0));
 
-    // Task 5: Move stopped job into foreground
-    else if (strcmp(first_token, "fg") == 0) {
-      if (resume_job(&tokens, &jobs, 1) == -1) {
-        printf("Failed to resume job in foreground\n");
+    if (builtin != NULL && !(builtin->flags & BUILTIN_CHILD)) {
+      run_builtin(builtin, &tokens, &shell);
+      if (shell.exiting) {
+        strvec_clear(&tokens);
+        break;
       }
     }
 
-    // Task 6: Move stopped job into background
-    else if (strcmp(first_token, "bg") == 0) {
-      if (resume_job(&tokens, &jobs, 0) == -1) {
-        printf("Failed to resume job in background\n");
+    else {
+      // check if the command is intended to be run in the background and
+      // remove the "&" so it is not passed on to the program
+      int is_background =
+          tokens.length > 1 &&
+          strcmp(strvec_get(&tokens, tokens.length - 1), "&") == 0;
+      if (is_background) {
+        strvec_take(&tokens, tokens.length - 1);
       }
-    }
 
-    // Task 6: Wait for a specific job identified by its index in job list
-    else if (strcmp(first_token, "wait-for") == 0) {
-      if (await_background_job(&tokens, &jobs) == -1) {
-        printf("Failed to wait for background job\n");
+      // captured background jobs write stdout and stderr into a pipe that
+      // the shell drains into the job's output buffer
+      int out_pipe[2] = {-1, -1};
+      if (is_background && shell.capture_output && pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        out_pipe[0] = out_pipe[1] = -1;
       }
-    }
 
-    // Task 6: Wait for all background jobs
-    else if (strcmp(first_token, "wait-all") == 0) {
-      if (await_all_background_jobs(&jobs) == -1) {
-        printf("Failed to wait for all background jobs\n");
+      // captured jobs get the pipe as stdout and stderr, others inherit the
+      // shell's
+      spawn_opts_t opts = {.null_stdin = 0,
+                           .out_fd = out_pipe[1],
+                           .err_fd = out_pipe[1],
+                           .mask = NULL,
+                           .close_fds = 0,
+                           .timeout = has_timeout ? &timeout : NULL,
+                           .output_pipe = out_pipe[0],
+                           .builtin = NULL,
+                           .shell = NULL};
+      pid_t pid = spawn_job(&tokens, &opts, is_background ? &shell.jobs : NULL,
+                            BACKGROUND);
+      if (out_pipe[1] != -1) {
+        close(out_pipe[1]);
       }
-    }
-
-    else {
-      // parent process
-      pid_t pid = fork();
       int status;
 
-      if (pid == 0) {
-        // child process
-        if (run_command(&tokens) == -1) {
-          // child exits on failure
-          exit(1);
+      if (pid > 0 && !is_background) {
+        // foreground job handling
+        // set the terminal's process group to the child's PID
+        if (tcsetpgrp(STDIN_FILENO, pid) == -1) {
+          perror("tcsetpgrp");
         }
-      } else if (pid > 0) {
-        // check if the command is intended to be run in the background
-        if (tokens.length > 0 &&
-            strcmp(strvec_get(&tokens, tokens.length - 1), "&") == 0) {
-          // remove the "&" from the token list
-          strvec_take(&tokens, tokens.length - 1);
-
-          // set the child process group
-          if (setpgid(pid, pid) == -1) {
-            perror("setpgid");
-          }
 
-          // add the job to the jobs list with status BACKGROUND
-          job_list_add(&jobs, pid, strvec_get(&tokens, 0), BACKGROUND);
-        } else {
-          // foreground job handling
-          // set the terminal's process group to the child's PID
-          if (tcsetpgrp(STDIN_FILENO, pid) == -1) {
-            perror("tcsetpgrp");
-          }
+        // track the foreground job so its deadline (if any) is enforced
+        job_t fg_job = {
+            .pid = pid, .status = FOREGROUND, .output_pipe = -1, .output_fd = -1};
+        if (has_timeout) {
+          job_set_timeout(&fg_job, &timeout);
+        }
 
-          // wait for the child process to finish or be stopped
-          if (waitpid(pid, &status, WUNTRACED) == -1) {
-            perror("waitpid");
-          }
+        // wait for the child process to finish or be stopped
+        if (wait_for_job(&shell.jobs, &fg_job, &status) == -1) {
+          status = 0;
+        }
 
-          // restore the shell to the foreground
-          if (tcsetpgrp(STDIN_FILENO, getpid()) == -1) {
-            perror("tcsetpgrp");
-          }
+        // restore the shell to the foreground
+        if (tcsetpgrp(STDIN_FILENO, getpid()) == -1) {
+          perror("tcsetpgrp");
+        }
 
-          // handle stopped process
-          if (WIFSTOPPED(status)) {
-            // add job to the job list with STOPPED status
-            job_list_add(&jobs, pid, strvec_get(&tokens, 0), STOPPED);
+        // handle stopped process
+        if (WIFSTOPPED(status)) {
+          // add job to the job list with STOPPED status, its deadline
+          // keeps running while it is stopped
+          if (job_list_add(&shell.jobs, pid, strvec_get(&tokens, 0), STOPPED) ==
+              0) {
+            job_t *job = job_list_get(&shell.jobs, shell.jobs.length - 1);
+            job->deadline = fg_job.deadline;
+            job->term_sent = fg_job.term_sent;
+            job_timer_arm(&shell.jobs, NULL);
           }
+        } else if (fg_job.status == TIMED_OUT) {
+          printf("Job timed out\n");
         }
-      } else {
-        // error on fork
-        perror("fork");
       }
     }
     strvec_clear(&tokens);
     printf("%s", PROMPT);
   }
-  job_list_free(&jobs);
+  job_list_free(&shell.jobs);
+  builtins_free();
+  line_edit_free();
   return 0;
 }
@@ -3,108 +3,583 @@
 #include "swish_funcs.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "builtins.h"
 #include "job_list.h"
+#include "job_output.h"
+#include "job_timer.h"
 #include "string_vector.h"
 
 #define MAX_ARGS 10
 
+// Append 'tok' to the last token, separated by a space, e.g. to put the
+// command of a process substitution back together
+static int join_token(strvec_t *tokens, const char *tok) {
+  const char *last = strvec_get(tokens, tokens->length - 1);
+  char *joined = malloc(strlen(last) + strlen(tok) + 2);
+  if (joined == NULL) {
+    return -1;
+  }
+  sprintf(joined, "%s %s", last, tok);
+  int ret = strvec_set(tokens, tokens->length - 1, joined);
+  free(joined);
+  return ret;
+}
+
 int tokenize(char *s, strvec_t *tokens) {
   // Tokenize string s with space as delimeter
   // Add each token to the 'tokens' parameter (a string vector)
   // Return 0 on success, -1 on error
   char *tok = strtok(s, " ");
+  int depth = 0;    // parentheses left open by a process substitution
   while (tok != NULL) {
-    if (strvec_add(tokens, tok) == -1) {
+    int ret;
+    if (depth > 0) {
+      ret = join_token(tokens, tok);
+    } else {
+      ret = strvec_add(tokens, tok);
+    }
+    if (ret == -1) {
       printf("Failed to add token to tokens string vector\n");
       return -1;
     }
+    if (depth > 0 || ((tok[0] == '<' || tok[0] == '>') && tok[1] == '(')) {
+      for (const char *c = tok; *c != '\0'; c++) {
+        depth += *c == '(' ? 1 : *c == ')' ? -1 : 0;
+      }
+    }
     tok = strtok(NULL, " ");
   }
   return 0;
 }
 
-int run_command(strvec_t *tokens) {
-  // program to be ran
-  char *program = strvec_get(tokens, 0);
+int take_timeout(strvec_t *tokens, struct timespec *timeout) {
+  timeout->tv_sec = 0;
+  timeout->tv_nsec = 0;
+  if (strcmp(strvec_get(tokens, 0), "timeout") != 0) {
+    return 0;
+  }
 
-  // command-line arguments for program
-  char *arguments[MAX_ARGS + 1];
+  // need at least a duration and a program to run
+  if (tokens->length < 3) {
+    fprintf(stderr, "Usage: timeout <duration> <command>\n");
+    return -1;
+  }
+  if (parse_duration(strvec_get(tokens, 1), timeout) == -1) {
+    fprintf(stderr, "Invalid timeout duration\n");
+    return -1;
+  }
 
-  // current token from tokens
-  // add tokens but exlude redirect operators
-  char *i_token;
-  int i = 0;
-  while ((i_token = strvec_get(tokens, i)) != NULL && i < MAX_ARGS - 1) {
-    // add current token to arguments array if it is not a redirect operator
-    if (strcmp(i_token, "<") == 0 || strcmp(i_token, ">") == 0 ||
-        strcmp(i_token, ">>") == 0) {
-      break;
+  // builtins run inside the shell, which a deadline must never kill
+  const builtin_t *builtin = builtin_lookup(strvec_get(tokens, 2));
+  if (builtin != NULL && !(builtin->flags & BUILTIN_CHILD)) {
+    fprintf(stderr, "timeout: cannot be used with builtin '%s'\n",
+            strvec_get(tokens, 2));
+    return -1;
+  }
+
+  strvec_drop(tokens, 2);
+  return 1;
+}
+
+int find_redirection(const strvec_t *tokens) {
+  for (int i = 0; i < tokens->length; i++) {
+    const char *token = strvec_get(tokens, i);
+    if (strcmp(token, "<") == 0 || strcmp(token, ">") == 0 ||
+        strcmp(token, ">>") == 0) {
+      return i;
     }
-    arguments[i] = i_token;
-    i++;
   }
-  // NULL sentinel
-  arguments[i] = NULL;
+  return -1;
+}
+
+int open_redirections(strvec_t *tokens, redirections_t *redirs) {
+  redirs->in_fd = -1;
+  redirs->num_out = 0;
 
   int fd;
   // check for redirection
-  for (i = 0; strvec_get(tokens, i) != NULL; i++) {
+  for (int i = 0; strvec_get(tokens, i) != NULL; i++) {
     if (strcmp(strvec_get(tokens, i), "<") == 0) {
-      // open file for reading
-      fd = open(strvec_get(tokens, i + 1), O_RDONLY);
+      // open file for reading, a later "<" replaces an earlier one
+      fd = open(strvec_get(tokens, i + 1), O_RDONLY | O_CLOEXEC);
       if (fd == -1) {
         perror("Failed to open input file");
+        close_redirections(redirs);
         return -1;
       }
-      // redirect stdin
-      if (dup2(fd, STDIN_FILENO) == -1) {
-        perror("dup2");
-        close(fd);
-        return -1;
+      if (redirs->in_fd != -1) {
+        close(redirs->in_fd);
       }
-      close(fd);
-    } else if (strcmp(strvec_get(tokens, i), ">") == 0) {
-      // open file for writing
-      fd = open(strvec_get(tokens, i + 1), O_WRONLY | O_CREAT | O_TRUNC,
-                S_IRUSR | S_IWUSR);
-      if (fd == -1) {
-        perror("Failed to open output file");
+      redirs->in_fd = fd;
+    } else if (strcmp(strvec_get(tokens, i), ">") == 0 ||
+               strcmp(strvec_get(tokens, i), ">>") == 0) {
+      if (redirs->num_out == MAX_OUTPUTS) {
+        fprintf(stderr, "Too many output redirections\n");
+        close_redirections(redirs);
         return -1;
       }
-      // redirect stdout
-      if (dup2(fd, STDOUT_FILENO) == -1) {
-        perror("dup2");
-        close(fd);
-        return -1;
+      // open file for writing (">") or appending (">>"). O_APPEND keeps
+      // concurrent appenders from overwriting each other and works for
+      // targets that can't seek, such as pipes and terminals.
+      int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+      if (strcmp(strvec_get(tokens, i), ">") == 0) {
+        flags |= O_TRUNC;
+      } else {
+        flags |= O_APPEND;
       }
-      close(fd);
-    } else if (strcmp(strvec_get(tokens, i), ">>") == 0) {
-      // open file for appending
-      fd = open(strvec_get(tokens, i + 1), O_WRONLY | O_CREAT | O_APPEND,
-                S_IRUSR | S_IWUSR);
+      fd = open(strvec_get(tokens, i + 1), flags, S_IRUSR | S_IWUSR);
       if (fd == -1) {
         perror("Failed to open output file");
+        close_redirections(redirs);
         return -1;
       }
-      // redirect stdout
-      if (dup2(fd, STDOUT_FILENO) == -1) {
+      redirs->out_fds[redirs->num_out] = fd;
+      redirs->num_out++;
+    }
+  }
+  return 0;
+}
+
+void close_redirections(redirections_t *redirs) {
+  if (redirs->in_fd != -1) {
+    close(redirs->in_fd);
+    redirs->in_fd = -1;
+  }
+  for (int i = 0; i < redirs->num_out; i++) {
+    close(redirs->out_fds[i]);
+  }
+  redirs->num_out = 0;
+}
+
+// The pipe ends of this process's command's substitutions, which a fan-out
+// pump forked from it closes, as it only writes to the output targets
+static int command_fds[MAX_SUBSTITUTIONS];
+static int num_command_fds = 0;
+
+static void close_command_fds(void) {
+  for (int i = 0; i < num_command_fds; i++) {
+    close(command_fds[i]);
+  }
+  num_command_fds = 0;
+}
+
+// Move 'len' bytes (or everything until EOF) from pipe 'from' to 'to', in
+// the kernel when possible, falling back to read/write for targets splice(2)
+// can't handle (e.g., O_APPEND files). If 'to' is -1, or a pipe whose reader
+// has gone away, the bytes are read from 'from' and dropped.
+// Returns 0 on success, 1 if 'to' was closed or -1 on error
+static int move_bytes(int from, int to, size_t len) {
+  char buf[4096];
+  int use_splice = 1;
+  int closed = 0;
+  while (len > 0) {
+    ssize_t n;
+    if (to == -1 || closed) {
+      n = read(from, buf, len < sizeof(buf) ? len : sizeof(buf));
+    } else if (use_splice) {
+      n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+      if (n == -1 && errno == EINVAL) {
+        use_splice = 0;
+        continue;
+      }
+    } else {
+      n = read(from, buf, len < sizeof(buf) ? len : sizeof(buf));
+      ssize_t done = 0;
+      while (n > 0 && done < n) {
+        ssize_t w = write(to, buf + done, n - done);
+        if (w != -1) {
+          done += w;
+        } else if (errno == EPIPE) {
+          closed = 1;    // the bytes read are dropped along with the rest
+          break;
+        } else if (errno != EINTR) {
+          perror("write");
+          return -1;
+        }
+      }
+    }
+
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      } else if (errno == EPIPE && !closed) {
+        closed = 1;
+        continue;
+      }
+      perror("splice");
+      return -1;
+    } else if (n == 0) {
+      break;
+    }
+    len -= n;
+  }
+  return closed;
+}
+
+// Copy everything written to pipe 'in' into each of 'fds' without a
+// userspace copy: tee(2) duplicates pending pipe data into a scratch pipe
+// that is spliced into one target, and the last target consumes 'in' itself.
+// A target whose reader goes away is dropped while the others keep receiving
+// the stream. With none left the rest is dropped too, so the command still
+// runs to completion.
+static int fan_out(int in, const int *fds, int num_fds) {
+  int scratch[2];
+  if (pipe(scratch) == -1) {
+    perror("pipe");
+    return -1;
+  }
+  int active[MAX_OUTPUTS];
+  memcpy(active, fds, num_fds * sizeof(int));
+
+  int ret = 0;
+  int eof = 0;
+  while (ret == 0 && !eof && num_fds > 1) {
+    // blocks until data arrives, returns 0 once all writers are gone
+    ssize_t len = tee(in, scratch[1], INT_MAX, 0);
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("tee");
+      ret = -1;
+      break;
+    } else if (len == 0) {
+      eof = 1;
+      break;
+    }
+
+    // the scratch pipe is empty here, so each tee() copies all 'len' bytes
+    int copied = 1;    // the first target's copy is already in the scratch pipe
+    for (int i = 0; ret == 0 && i < num_fds - 1;) {
+      int moved;
+      if (!copied && tee(in, scratch[1], len, 0) != len) {
+        perror("tee");
+        ret = -1;
+      } else if ((moved = move_bytes(scratch[0], active[i], len)) == -1) {
+        ret = -1;
+      } else if (moved == 1) {
+        memmove(&active[i], &active[i + 1], (num_fds - i - 1) * sizeof(int));
+        num_fds--;
+      } else {
+        i++;
+      }
+      copied = 0;
+    }
+    if (ret == 0) {
+      int moved = move_bytes(in, active[num_fds - 1], len);
+      if (moved == -1) {
+        ret = -1;
+      } else if (moved == 1) {
+        num_fds--;
+      }
+    }
+  }
+
+  // a single target left takes the rest of the stream directly
+  if (ret == 0 && !eof &&
+      move_bytes(in, num_fds == 1 ? active[0] : -1, SIZE_MAX) == -1) {
+    ret = -1;
+  }
+
+  close(scratch[0]);
+  close(scratch[1]);
+  return ret;
+}
+
+int apply_redirections(strvec_t *tokens) {
+  redirections_t redirs;
+  if (open_redirections(tokens, &redirs) == -1) {
+    return -1;
+  }
+
+  // redirect stdin
+  if (redirs.in_fd != -1 && dup2(redirs.in_fd, STDIN_FILENO) == -1) {
+    perror("dup2");
+    close_redirections(&redirs);
+    return -1;
+  }
+
+  // redirect stdout, every output target receives the full stream
+  if (redirs.num_out == 1) {
+    if (dup2(redirs.out_fds[0], STDOUT_FILENO) == -1) {
+      perror("dup2");
+      close_redirections(&redirs);
+      return -1;
+    }
+  } else if (redirs.num_out > 1) {
+    int out_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+      perror("pipe2");
+      close_redirections(&redirs);
+      return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+      perror("fork");
+      close(out_pipe[0]);
+      close(out_pipe[1]);
+      close_redirections(&redirs);
+      return -1;
+    }
+
+    if (pid == 0) {
+      // the new child carries on with the command, writing into the pipe
+      close(out_pipe[0]);
+      if (dup2(out_pipe[1], STDOUT_FILENO) == -1) {
         perror("dup2");
-        close(fd);
         return -1;
       }
-      close(fd);
+      close(out_pipe[1]);
+    } else {
+      // the caller stays behind to fan the output out, then exits with
+      // the command's status so it can stand in for it as the job's process.
+      // _exit() keeps stdio buffers inherited from the shell from being flushed.
+      close(out_pipe[1]);
+      close_command_fds();
+      // a target closing early shows up as EPIPE, the others carry on
+      signal(SIGPIPE, SIG_IGN);
+      int ret = fan_out(out_pipe[0], redirs.out_fds, redirs.num_out);
+      close(out_pipe[0]);
+      close_redirections(&redirs);
+
+      int status;
+      if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+        _exit(1);
+      }
+      if (WIFSIGNALED(status)) {
+        _exit(128 + WTERMSIG(status));
+      }
+      _exit(ret == -1 ? 1 : WEXITSTATUS(status));
+    }
+  }
+
+  close_redirections(&redirs);
+  return 0;
+}
+
+int is_substitution(const char *token) {
+  size_t len = strlen(token);
+  return len > 3 && (token[0] == '<' || token[0] == '>') && token[1] == '(' &&
+         token[len - 1] == ')';
+}
+
+// Fork the command of a process substitution, with the write end of 'fds'
+// as its stdout for "<(cmd)", or the read end as its stdin for ">(cmd)".
+// It stays in the caller's process group, so it belongs to the same job.
+// 'others' are the command's ends of the substitutions started before it.
+// 'mask' is the signal mask to give it, or NULL to keep the caller's.
+static pid_t start_substitution(const char *token, const int *fds,
+                                const int *others, int num_others,
+                                const sigset_t *mask) {
+  int is_input = token[0] == '<';
+  pid_t pid = fork();
+  if (pid != 0) {
+    if (pid == -1) {
+      perror("fork");
+    }
+    return pid;
+  }
+
+  if (mask != NULL) {
+    sigprocmask(SIG_SETMASK, mask, NULL);
+  }
+  if (dup2(is_input ? fds[1] : fds[0], is_input ? STDOUT_FILENO : STDIN_FILENO) == -1) {
+    perror("dup2");
+    _exit(1);
+  }
+  // close-on-exec alone is not enough: a nested substitution's reaper or a
+  // fan-out pump never execs, and a write end it kept would hold off EOF
+  close(fds[0]);
+  close(fds[1]);
+  for (int i = 0; i < num_others; i++) {
+    close(others[i]);
+  }
+  char *cmd = strndup(token + 2, strlen(token) - 3);
+  strvec_t tokens;
+  if (cmd == NULL || strvec_init(&tokens) == -1 || tokenize(cmd, &tokens) == -1 ||
+      tokens.length == 0) {
+    fprintf(stderr, "Invalid process substitution\n");
+    _exit(1);
+  }
+  exec_command(&tokens);
+  _exit(1);
+}
+
+// Start every process substitution in 'tokens', replacing each one with the
+// /dev/fd path of the command's end of its pipe. The command's ends and the
+// substitutions' PIDs are stored in 'subs', including those started before
+// an error.
+static int start_substitutions(strvec_t *tokens, const sigset_t *mask,
+                               substitutions_t *subs) {
+  int *fds = subs->fds;    // the command's end of each pipe
+  int num = 0;
+  int ret = 0;
+  for (unsigned i = 0; ret == 0 && i < tokens->length; i++) {
+    const char *token = strvec_get(tokens, i);
+    if (!is_substitution(token)) {
+      continue;
+    }
+    if (num == MAX_SUBSTITUTIONS) {
+      fprintf(stderr, "Too many process substitutions\n");
+      ret = -1;
+      break;
+    }
+
+    // close-on-exec, so no substitution holds another one's pipe open
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+      perror("pipe2");
+      ret = -1;
+      break;
+    }
+    int is_input = token[0] == '<';
+    pid_t pid = start_substitution(token, pipe_fds, fds, num, mask);
+    close(is_input ? pipe_fds[1] : pipe_fds[0]);
+    fds[num] = is_input ? pipe_fds[0] : pipe_fds[1];
+    if (pid == -1) {
+      close(fds[num]);
+      ret = -1;
+      break;
+    }
+    subs->pids[num++] = pid;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fds[num - 1]);
+    if (strvec_set(tokens, i, path) == -1) {
+      fprintf(stderr, "Failed to replace process substitution\n");
+      ret = -1;
+    }
+  }
+  subs->num = num;
+  return ret;
+}
+
+int apply_substitutions(strvec_t *tokens) {
+  substitutions_t subs;
+  int ret = start_substitutions(tokens, NULL, &subs);
+  int *fds = subs.fds;
+  int num = subs.num;
+
+  pid_t pid = -1;
+  if (ret == 0 && num > 0 && (pid = fork()) == -1) {
+    perror("fork");
+    ret = -1;
+  }
+  if (ret == -1 || num == 0 || pid == 0) {
+    // the new child carries on with the command, which keeps its pipe ends
+    // open across exec
+    for (int i = 0; i < num; i++) {
+      if (ret == -1) {
+        close(fds[i]);
+      } else if (fcntl(fds[i], F_SETFD, 0) == -1) {
+        perror("fcntl");
+        ret = -1;
+      }
+    }
+    if (ret == 0) {
+      memcpy(command_fds, fds, num * sizeof(fds[0]));
+      num_command_fds = num;
+    }
+    return ret;
+  }
+
+  // the caller stays behind as the job's process and reaps the command and
+  // its substitutions, then exits with the command's status. Its pipe ends
+  // are closed first so that a substitution sees EOF (or SIGPIPE) once the
+  // command is done with it.
+  for (int i = 0; i < num; i++) {
+    close(fds[i]);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) == -1) {
+    perror("waitpid");
+    _exit(1);
+  }
+  for (int i = 0; i < num; i++) {
+    waitpid(subs.pids[i], NULL, 0);
+  }
+  if (WIFSIGNALED(status)) {
+    _exit(128 + WTERMSIG(status));
+  }
+  _exit(WEXITSTATUS(status));
+}
+
+int open_substitutions(strvec_t *tokens, const sigset_t *mask,
+                       substitutions_t *subs) {
+  if (start_substitutions(tokens, mask, subs) == -1) {
+    close_substitutions(subs);
+    return -1;
+  }
+  return 0;
+}
+
+void close_substitutions(substitutions_t *subs) {
+  // the pipe ends go first, so each substitution sees EOF (or SIGPIPE)
+  for (int i = 0; i < subs->num; i++) {
+    close(subs->fds[i]);
+  }
+  for (int i = 0; i < subs->num; i++) {
+    while (waitpid(subs->pids[i], NULL, 0) == -1 && errno == EINTR) {
     }
   }
+  subs->num = 0;
+}
+
+int run_command(strvec_t *tokens) {
+  pid_t pid = getpid();
+  // set process group id to pid, before redirecting so that a process
+  // forked to fan out output to multiple targets joins the same group
+  if (setpgid(0, pid) == -1) {
+    perror("setpgid");
+    return -1;
+  }
+
+  return exec_command(tokens);
+}
+
+int exec_command(strvec_t *tokens) {
+  // start any process substitutions, replacing them with their /dev/fd paths
+  if (apply_substitutions(tokens) == -1) {
+    return -1;
+  }
+
+  // program to be ran
+  char *program = strvec_get(tokens, 0);
+
+  // command-line arguments for program
+  char *arguments[MAX_ARGS + 1];
+
+  // current token from tokens
+  // add tokens but exlude redirect operators
+  char *i_token;
+  int i = 0;
+  while ((i_token = strvec_get(tokens, i)) != NULL && i < MAX_ARGS - 1) {
+    // add current token to arguments array if it is not a redirect operator
+    if (strcmp(i_token, "<") == 0 || strcmp(i_token, ">") == 0 ||
+        strcmp(i_token, ">>") == 0) {
+      break;
+    }
+    arguments[i] = i_token;
+    i++;
+  }
+  // NULL sentinel
+  arguments[i] = NULL;
 
   // reset signal handlers
   struct sigaction sac;
@@ -122,10 +597,7 @@ int run_command(strvec_t *tokens) {
     return -1;
   }
 
-  pid_t pid = getpid();
-  // set process group id to pid
-  if (setpgid(0, pid) == -1) {
-    perror("setpgid");
+  if (apply_redirections(tokens) == -1) {
     return -1;
   }
 
@@ -136,6 +608,118 @@ int run_command(strvec_t *tokens) {
   return -1;
 }
 
+void run_job(strvec_t *tokens) {
+  // builtins such as watch-run run here, in the job's child process
+  const builtin_t *builtin = builtin_lookup(strvec_get(tokens, 0));
+  if (builtin != NULL && (builtin->flags & BUILTIN_CHILD)) {
+    int builtin_status = builtin->fn(tokens, NULL);
+    fflush(stdout);
+    exit(builtin_status == -1 ? 1 : builtin_status);
+  }
+  run_command(tokens);
+  // child exits on failure
+  exit(1);
+}
+
+// Run a builtin as a job's command, in the job's child process
+static void run_builtin_job(const builtin_t *builtin, strvec_t *tokens,
+                            shell_t *shell) {
+  // join the job's own group before a fan-out pump may be forked
+  if (setpgid(0, 0) == -1) {
+    perror("setpgid");
+  }
+  if (apply_substitutions(tokens) == -1 || apply_redirections(tokens) == -1) {
+    exit(1);
+  }
+  int redirect_idx = find_redirection(tokens);
+  if (redirect_idx != -1) {
+    strvec_take(tokens, redirect_idx);
+  }
+  int ret = builtin->fn(tokens, shell);
+  fflush(stdout);
+  exit(ret == -1 ? 1 : 0);
+}
+
+pid_t spawn_job(strvec_t *tokens, const spawn_opts_t *opts, job_list_t *jobs,
+                job_status_t status) {
+  // the child must not inherit (and later repeat) buffered output
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    if (jobs != NULL && opts->output_pipe != -1) {
+      close(opts->output_pipe);
+    }
+    return -1;
+  }
+
+  if (pid == 0) {
+    // child process
+    if (opts->mask != NULL) {
+      sigprocmask(SIG_SETMASK, opts->mask, NULL);
+    }
+    int null_fd = opts->null_stdin ? open("/dev/null", O_RDONLY) : -1;
+    if ((opts->null_stdin && (null_fd == -1 || dup2(null_fd, STDIN_FILENO) == -1)) ||
+        (opts->out_fd != -1 && dup2(opts->out_fd, STDOUT_FILENO) == -1) ||
+        (opts->err_fd != -1 && dup2(opts->err_fd, STDERR_FILENO) == -1)) {
+      perror("dup2");
+      exit(1);
+    }
+    if (opts->close_fds) {
+      close_range(STDERR_FILENO + 1, ~0U, 0);
+    } else if (null_fd != -1) {
+      close(null_fd);
+    }
+    if (opts->builtin != NULL) {
+      run_builtin_job(opts->builtin, tokens, opts->shell);
+    }
+    run_job(tokens);
+  }
+
+  // set the child process group, EACCES means the child already exec'd,
+  // after setting its own process group
+  if (setpgid(pid, pid) == -1 && errno != EACCES) {
+    perror("setpgid");
+  }
+  if (jobs == NULL) {
+    return pid;
+  }
+
+  if (job_list_add(jobs, pid, strvec_get(tokens, 0), status) == -1) {
+    // an untracked job would never be reaped
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (opts->output_pipe != -1) {
+      close(opts->output_pipe);
+    }
+    return -1;
+  }
+  job_t *job = job_list_get(jobs, jobs->length - 1);
+  if (opts->timeout != NULL) {
+    job_set_timeout(job, opts->timeout);
+    job_timer_arm(jobs, NULL);
+  }
+  if (opts->output_pipe != -1) {
+    job_output_attach(job, opts->output_pipe);
+  }
+  return pid;
+}
+
+int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1) {
+      perror("write");
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
 int resume_job(strvec_t *tokens, job_list_t *jobs, int is_foreground) {
   // check if the correct number of arguments are provided
   if (tokens->length < 2) {
@@ -172,8 +756,9 @@ int resume_job(strvec_t *tokens, job_list_t *jobs, int is_foreground) {
     }
   }
 
-  // send SIGCONT signal to job
-  if (kill(job->pid, SIGCONT) == -1) {
+  // send SIGCONT signal to job's whole process group, which includes any
+  // processes the job forked (e.g., the tee/splice pump for fan-out)
+  if (kill(-job->pid, SIGCONT) == -1) {
     perror("kill");
     return -1;
   }
@@ -181,8 +766,7 @@ int resume_job(strvec_t *tokens, job_list_t *jobs, int is_foreground) {
   if (is_foreground) {
     // wait for job to finish
     int status;
-    if (waitpid(job->pid, &status, WUNTRACED) == -1) {
-      perror("waitpid");
+    if (wait_for_job(jobs, job, &status) == -1) {
       return -1;
     }
 
@@ -228,8 +812,8 @@ int await_background_job(strvec_t *tokens, job_list_t *jobs) {
     return -1;
   }
 
-  // check if job is a background job
-  if (job->status != BACKGROUND) {
+  // check if job is a background job (timed out jobs still need reaping)
+  if (job->status != BACKGROUND && job->status != TIMED_OUT) {
     fprintf(stderr,
             "Job index is for stopped process not background process\n");
     return -1;
@@ -237,8 +821,7 @@ int await_background_job(strvec_t *tokens, job_list_t *jobs) {
 
   // wait for job to finish
   int status;
-  if (waitpid(job->pid, &status, WUNTRACED) == -1) {
-    perror("waitpid");
+  if (wait_for_job(jobs, job, &status) == -1) {
     return -1;
   }
 
@@ -262,12 +845,11 @@ int await_all_background_jobs(job_list_t *jobs) {
     next_job = current->next;
 
     // if the job is not stopped, wait
-    if (current->status == BACKGROUND) {
+    if (current->status == BACKGROUND || current->status == TIMED_OUT) {
       int status;
 
       // wait for background job
-      if (waitpid(current->pid, &status, WUNTRACED) == -1) {
-        perror("waitpid");
+      if (wait_for_job(jobs, current, &status) == -1) {
         return -1;
       }
 
@@ -290,3 +872,180 @@ int await_all_background_jobs(job_list_t *jobs) {
 
   return 0;
 }
+
+// returns nonzero if any job has a deadline or output pipe to service
+static int has_job_events(job_list_t *jobs) {
+  if (jobs->timer_fd != -1) {
+    return 1;
+  }
+  for (job_t *current = jobs->head; current != NULL; current = current->next) {
+    if (current->output_pipe != -1) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Poll 'fd' together with the deadline timer and the captured output pipes
+// of all jobs, servicing timer and output events until 'fd' is readable
+static int poll_jobs(job_list_t *jobs, job_t *extra, int fd) {
+  // the buffer only grows, so waiting with a steady set of jobs allocates
+  // nothing, and jobs can't be added while the shell waits
+  if (jobs->poll_capacity < jobs->length + 2) {
+    struct pollfd *new_fds =
+        realloc(jobs->poll_fds, (jobs->length + 2) * sizeof(struct pollfd));
+    if (new_fds == NULL) {
+      perror("realloc");
+      return -1;
+    }
+    jobs->poll_fds = new_fds;
+    jobs->poll_capacity = jobs->length + 2;
+  }
+  struct pollfd *fds = jobs->poll_fds;
+
+  while (1) {
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = jobs->timer_fd;    // poll() skips this entry if it is -1
+    fds[1].events = POLLIN;
+    nfds_t nfds = 2;
+    for (job_t *cur = jobs->head; cur != NULL; cur = cur->next) {
+      if (cur->output_pipe != -1) {
+        fds[nfds].fd = cur->output_pipe;
+        fds[nfds].events = POLLIN;
+        nfds++;
+      }
+    }
+
+    if (poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return -1;
+    }
+
+    int ready = fds[0].revents != 0;
+    int timer_ready = fds[1].revents & POLLIN;
+    int output_ready = 0;
+    for (nfds_t i = 2; i < nfds; i++) {
+      output_ready |= fds[i].revents != 0;
+    }
+
+    if (output_ready && job_output_drain_all(jobs) == -1) {
+      return -1;
+    }
+    if (timer_ready && job_timer_expire(jobs, extra) == -1) {
+      return -1;
+    }
+    if (ready) {
+      return 0;
+    }
+  }
+}
+
+int print_job_output(strvec_t *tokens, job_list_t *jobs) {
+  // check if the correct number of arguments are provided
+  if (tokens->length < 3) {
+    fprintf(stderr, "Usage: jobs output <job number>\n");
+    return -1;
+  }
+
+  int job_num;
+  // parse job number
+  if (sscanf(strvec_get(tokens, 2), "%d", &job_num) != 1) {
+    fprintf(stderr, "Invalid job number\n");
+    return -1;
+  }
+
+  // get job from job list
+  job_t *job = job_list_get(jobs, job_num);
+  // check if job is in bounds
+  if (job == NULL) {
+    fprintf(stderr, "Job index out of bounds\n");
+    return -1;
+  }
+
+  // check if job's output is being captured
+  if (job->output_fd == -1) {
+    fprintf(stderr, "Job output is not captured\n");
+    return -1;
+  }
+
+  // pick up anything written since the last drain, then replay the ring
+  if (job_output_drain(job) == -1) {
+    return -1;
+  }
+  fflush(stdout);
+  return job_output_write(job, STDOUT_FILENO);
+}
+
+int wait_for_job(job_list_t *jobs, job_t *job, int *status) {
+  if (job_timer_arm(jobs, job) == -1) {
+    return -1;
+  }
+
+  // no deadlines or captured output, nothing to service while blocked
+  if (!has_job_events(jobs)) {
+    if (waitpid(job->pid, status, WUNTRACED) == -1) {
+      perror("waitpid");
+      return -1;
+    }
+    return 0;
+  }
+
+  // block SIGCHLD so child state changes are queued for the signalfd and
+  // can be polled together with the deadline timer and output pipes
+  sigset_t chld_mask, old_mask;
+  if (sigemptyset(&chld_mask) == -1 || sigaddset(&chld_mask, SIGCHLD) == -1) {
+    perror("sigaddset");
+    return -1;
+  }
+  if (sigprocmask(SIG_BLOCK, &chld_mask, &old_mask) == -1) {
+    perror("sigprocmask");
+    return -1;
+  }
+  int sig_fd = signalfd(-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sig_fd == -1) {
+    perror("signalfd");
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return -1;
+  }
+
+  int ret = 0;
+  while (1) {
+    // checked after blocking SIGCHLD, so no state change can be missed
+    pid_t pid = waitpid(job->pid, status, WUNTRACED | WNOHANG);
+    if (pid == -1) {
+      perror("waitpid");
+      ret = -1;
+      break;
+    } else if (pid == job->pid) {
+      break;
+    }
+
+    if (poll_jobs(jobs, job, sig_fd) == -1) {
+      ret = -1;
+      break;
+    }
+    struct signalfd_siginfo info;
+    while (read(sig_fd, &info, sizeof(info)) > 0) {
+    }
+  }
+
+  close(sig_fd);
+  if (sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
+    perror("sigprocmask");
+    return -1;
+  }
+  return ret;
+}
+
+int wait_for_input(job_list_t *jobs) {
+  // stdio only flushes the prompt on its own once fgets() reads
+  fflush(stdout);
+  if (!has_job_events(jobs)) {
+    return 0;
+  }
+  return poll_jobs(jobs, NULL, STDIN_FILENO);
+}
@@ -4,6 +4,11 @@
 #ifndef SWISH_FUNCS_H
 #define SWISH_FUNCS_H
 
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "builtins.h"
 #include "job_list.h"
 #include "string_vector.h"
 
@@ -12,6 +17,8 @@
  * Divide a string with substrings separated by a single space (" ")
  * into tokens. These tokens should be stored in the 'tokens' vector using
  * "strvec_add".
+ * A process substitution keeps its command's spaces and stays one token,
+ * e.g. "diff <(sort a.txt) b.txt" gives "diff", "<(sort a.txt)" and "b.txt"
  * s: String to tokenize
  * vec: Pointer to vector in which to store tokens. Must be initialized
  *      before this function is called.
@@ -19,6 +26,118 @@
  */
 int tokenize(char *s, strvec_t *tokens);
 
+/*
+ * Strip a leading "timeout <duration>" prefix from a command, e.g.
+ * "timeout 5 ./slow_write 10 1" becomes "./slow_write 10 1"
+ * tokens: Tokens from the command typed in by the user
+ * timeout: Set to the parsed duration, or {0, 0} if there is no prefix
+ * Returns 1 if a prefix was removed, 0 if there was none, or -1 if the prefix
+ * is malformed or the command is a builtin
+ */
+int take_timeout(strvec_t *tokens, struct timespec *timeout);
+
+// Maximum number of output targets (">" or ">>") in a single command
+#define MAX_OUTPUTS 8
+
+// Files opened for the redirections in a command
+typedef struct {
+  int in_fd;                   // file for "<", or -1 if stdin is not redirected
+  int out_fds[MAX_OUTPUTS];    // files for each ">" and ">>", in command order
+  int num_out;
+} redirections_t;
+
+/*
+ * Find the first redirection operator ("<", ">" or ">>") in a command
+ * tokens: Tokens from the command typed in by the user
+ * Returns the operator's index, or -1 if the command has no redirections
+ */
+int find_redirection(const strvec_t *tokens);
+
+/*
+ * Open the files named by the redirections ("<", ">", ">>") in a command
+ * Only the last "<" is kept, but every output target is kept since each one
+ * receives the command's full output
+ * tokens: Tokens from the command typed in by the user
+ * redirs: Set to the opened files, release them with close_redirections()
+ * Returns 0 on success or -1 on error (no files are left open)
+ */
+int open_redirections(strvec_t *tokens, redirections_t *redirs);
+
+/*
+ * Close all files opened by open_redirections()
+ * redirs: The redirections to close
+ */
+void close_redirections(redirections_t *redirs);
+
+/*
+ * Apply the input/output redirections ("<", ">", ">>") in a command to the
+ * calling process's stdin and stdout
+ * With more than one output target, stdout becomes a pipe and the calling
+ * process forks: the new child returns from this function and carries on with
+ * the command, while the caller copies the pipe into every target using
+ * tee(2)/splice(2), then exits with the child's status. This must therefore
+ * only be called in a process forked from the shell.
+ * tokens: Tokens from the command typed in by the user
+ * Returns 0 on success or -1 on error
+ */
+int apply_redirections(strvec_t *tokens);
+
+// Maximum number of process substitutions in a single command
+#define MAX_SUBSTITUTIONS 8
+
+/*
+ * Check whether a token is a process substitution, "<(cmd ...)" or ">(cmd ...)"
+ * token: Token to check
+ * Returns 1 if it is a process substitution or 0 otherwise
+ */
+int is_substitution(const char *token);
+
+/*
+ * Start the process substitutions in a command, each connected to the command
+ * by a pipe that it reaches through a "/dev/fd/N" path: "<(cmd)" is replaced
+ * by a path to read cmd's stdout from and ">(cmd)" by a path to write to
+ * cmd's stdin. The substitutions run concurrently with the command, in the
+ * caller's process group. With any substitutions, the calling process then
+ * forks like apply_redirections() does: the new child returns from this
+ * function and carries on with the command, while the caller reaps the
+ * command and every substitution, then exits with the command's status. The
+ * job's process therefore only finishes once all of them have. Each
+ * substitution keeps only its own end of its pipe, so it sees EOF as soon as
+ * the command closes the other one. This must only be called in a process
+ * forked from the shell.
+ * tokens: Tokens of the command, substitutions are replaced in place
+ * Returns 0 on success or -1 on error
+ */
+int apply_substitutions(strvec_t *tokens);
+
+// Process substitutions started for a builtin that runs in the shell itself
+typedef struct {
+  int fds[MAX_SUBSTITUTIONS];      // the shell's end of each pipe
+  pid_t pids[MAX_SUBSTITUTIONS];
+  int num;
+} substitutions_t;
+
+/*
+ * Start the process substitutions in a command run by the shell itself,
+ * replacing them with their "/dev/fd/N" paths like apply_substitutions()
+ * does, but without forking a process to reap them. The substitutions run in
+ * the shell's process group.
+ * tokens: Tokens of the command, substitutions are replaced in place
+ * mask: Signal mask for the substitutions, or NULL to keep the shell's
+ * subs: Set to the started substitutions, finish them with
+ *       close_substitutions()
+ * Returns 0 on success or -1 on error (no substitutions are left running)
+ */
+int open_substitutions(strvec_t *tokens, const sigset_t *mask,
+                       substitutions_t *subs);
+
+/*
+ * Close the shell's ends of the pipes to substitutions started by
+ * open_substitutions(), then wait for each substitution to finish
+ * subs: The substitutions to finish
+ */
+void close_substitutions(substitutions_t *subs);
+
 /*
  * Task 2: Run a user-specified command (including arguments)
  * This should be called within a CHILD process of the shell
@@ -28,6 +147,67 @@ int tokenize(char *s, strvec_t *tokens);
  */
 int run_command(strvec_t *tokens);
 
+/*
+ * Same as run_command(), except that the calling process stays in its current
+ * process group, e.g., when a job runs a command as one of its own children.
+ * Process substitutions are started before the redirections are applied, so
+ * a redirection may target one, e.g. "./slow_write 5 0 > >(wc -l)".
+ * tokens: Tokens of the command to run
+ * Doesn't return on success (similar to exec) or returns -1 on error
+ */
+int exec_command(strvec_t *tokens);
+
+/*
+ * Run a job's command, dispatching builtins registered with BUILTIN_CHILD
+ * (e.g., "watch-run" and "cached") to their handler and anything else to
+ * run_command()
+ * This should be called within a CHILD process of the shell
+ * tokens: Tokens of the command to run
+ * Doesn't return, the child exits with status 1 on error
+ */
+void run_job(strvec_t *tokens);
+
+// How spawn_job() sets up a job's child process and tracks the job
+typedef struct {
+  int null_stdin;                   // 1 to read stdin from /dev/null
+  int out_fd;                       // becomes the job's stdout, or -1
+  int err_fd;                       // becomes the job's stderr, or -1
+  const sigset_t *mask;             // signal mask for the job, or NULL
+  int close_fds;                    // 1 to close all other inherited descriptors
+  const struct timespec *timeout;   // deadline for the job, or NULL
+  int output_pipe;                  // read end to attach as the job's captured
+                                    // output (see job_output.h), or -1
+  const builtin_t *builtin;         // builtin to run instead of the command, or NULL
+  shell_t *shell;                   // shell passed to 'builtin'
+} spawn_opts_t;
+
+/*
+ * Fork a child that runs a job's command with run_job() (or 'opts->builtin',
+ * with the command's redirections applied) in its own process group, and add
+ * the job to a jobs list with its deadline and captured output
+ * The parent keeps its copies of 'out_fd' and 'err_fd', and the job takes
+ * ownership of 'output_pipe', even on error. If the job can't be added to the
+ * list, the child is killed, since it could never be reaped.
+ * tokens: Tokens of the command to run, without any "&"
+ * opts: How to set up the child and the job
+ * jobs: List to add the job to as the last job, or NULL to leave the job
+ *       untracked (e.g., the interactive shell's foreground job), in which
+ *       case the deadline and output pipe are not used
+ * status: Status of the new job in 'jobs'
+ * Returns the job's pid or -1 on error
+ */
+pid_t spawn_job(strvec_t *tokens, const spawn_opts_t *opts, job_list_t *jobs,
+                job_status_t status);
+
+/*
+ * Write all of a buffer to a file descriptor, retrying short writes
+ * fd: Descriptor to write to
+ * buf: Data to write
+ * len: Number of bytes to write
+ * Returns 0 on success or -1 on error
+ */
+int write_all(int fd, const char *buf, size_t len);
+
 /*
  * Task 5: Resume a stopped (paused) process
  * This can be called from the shell process itself, no need for a fork()
@@ -59,4 +239,31 @@ int await_background_job(strvec_t *tokens, job_list_t *jobs);
  */
 int await_all_background_jobs(job_list_t *jobs);
 
+/*
+ * Print the output captured for a background job (see job_output.h)
+ * tokens: Tokens from the command typed in by the user, e.g., "jobs output 0"
+ * jobs: Pointer to the list of current jobs for the shell
+ * Returns 0 on success or -1 on error
+ */
+int print_job_output(strvec_t *tokens, job_list_t *jobs);
+
+/*
+ * Block the calling shell process until a job's process stops or exits,
+ * enforcing the deadlines of all jobs (see job_timer.h) and capturing
+ * background output (see job_output.h) while waiting
+ * jobs: Pointer to the list of current jobs for the shell
+ * job: The job to wait for, either an element of 'jobs' or the foreground job
+ * status: Set to the status reported by waitpid()
+ * Returns 0 on success or -1 on error
+ */
+int wait_for_job(job_list_t *jobs, job_t *job, int *status);
+
+/*
+ * Block the calling shell process until standard input is readable,
+ * enforcing job deadlines and capturing background output in the meantime
+ * jobs: Pointer to the list of current jobs for the shell
+ * Returns 0 on success or -1 on error
+ */
+int wait_for_input(job_list_t *jobs);
+
 #endif    // SWISH_FUNCS_H
@@ -0,0 +1,3 @@
+# The subshell survives a SIGTERM sent to the whole process group
+(trap '' TERM; sleep 3; echo survivor) &
+wait
@@ -1,21 +1,166 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#define NSEC_PER_SEC 1000000000L
+
+// How stdin is used, see usage()
+typedef enum { STDIN_IGNORE, STDIN_LINE, STDIN_DRAIN } stdin_mode_t;
+
+// When records are synced to disk, see usage()
+typedef enum { SYNC_NONE, SYNC_EACH, SYNC_END } sync_mode_t;
+
+static void usage(void) {
+    printf("Usage: [options] <max_num> <delay> [out_file]\n"
+           "Writes records numbered 1 to max_num, waiting 'delay' between bursts.\n"
+           "The delay is in seconds unless suffixed with s, ms, us or ns.\n"
+           "  -s <size>   pad each record to 'size' bytes (including the newline)\n"
+           "  -b <count>  write records in bursts of 'count' (default 1)\n"
+           "  -e          exponentially distributed delays with the given mean\n"
+           "  -u          flush after every burst instead of buffering\n"
+           "  -f <mode>   fsync: 'each' burst or at the 'end' (implies -u)\n"
+           "  -i <mode>   stdin: each record echoes a 'line' of it (ends at EOF),\n"
+           "              or 'drain' it all before writing\n"
+           "  -t          prefix each record with a CLOCK_MONOTONIC timestamp (ns)\n");
+}
+
+// Parse a duration such as "2", "0.5", "250ms" or "100us"
+static int parse_delay(const char *s, struct timespec *delay) {
+    char *end;
+    double value = strtod(s, &end);
+    double scale = 1;
+    if (end == s || value < 0) {
+        return -1;
+    }
+    if (strcmp(end, "ms") == 0) {
+        scale = 1e-3;
+    } else if (strcmp(end, "us") == 0) {
+        scale = 1e-6;
+    } else if (strcmp(end, "ns") == 0) {
+        scale = 1e-9;
+    } else if (*end != '\0' && strcmp(end, "s") != 0) {
+        return -1;
+    }
+    long long nsec = (long long) (value * scale * NSEC_PER_SEC);
+    delay->tv_sec = nsec / NSEC_PER_SEC;
+    delay->tv_nsec = nsec % NSEC_PER_SEC;
+    return 0;
+}
+
+// Parse a non-negative decimal number with nothing after it
+static int parse_count(const char *s, unsigned long *count) {
+    char *end;
+    errno = 0;
+    *count = strtoul(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || s[strspn(s, " \t")] == '-') {
+        return -1;
+    }
+    return 0;
+}
+
+static void add_nsec(struct timespec *t, long long nsec) {
+    nsec += t->tv_nsec;
+    t->tv_sec += nsec / NSEC_PER_SEC;
+    t->tv_nsec = nsec % NSEC_PER_SEC;
+}
+
+// returns nonzero if time a is strictly before time b
+static int time_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// Write one record: an optional timestamp, the record's text, padding
+static int write_record(FILE *fout, const char *text, size_t size, int timestamp) {
+    int len = 0;
+    if (timestamp) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        len += fprintf(fout, "%lld ", (long long) now.tv_sec * NSEC_PER_SEC + now.tv_nsec);
+    }
+    len += fprintf(fout, "%s", text);
+    for (; len + 1 < (int) size; len++) {
+        putc('.', fout);
+    }
+    return putc('\n', fout) == EOF ? -1 : 0;
+}
+
 int main(int argc, char **argv) {
     int limit = 0;
-    int delay;
+    struct timespec delay;
     FILE *fout;
+    unsigned long size = 0;
+    unsigned long burst = 1;
+    int exponential = 0;
+    int flush = 0;
+    int timestamp = 0;
+    sync_mode_t sync_mode = SYNC_NONE;
+    stdin_mode_t stdin_mode = STDIN_IGNORE;
 
-    if (argc < 3) {
-        printf("Usage: <max_num> <delay> [out_file]\n");
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:euf:i:t")) != -1) {
+        switch (opt) {
+            case 's':
+                if (parse_count(optarg, &size) == -1) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'b':
+                if (parse_count(optarg, &burst) == -1 || burst < 1) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'e':
+                exponential = 1;
+                break;
+            case 'u':
+                flush = 1;
+                break;
+            case 'f':
+                if (strcmp(optarg, "each") == 0) {
+                    sync_mode = SYNC_EACH;
+                } else if (strcmp(optarg, "end") == 0) {
+                    sync_mode = SYNC_END;
+                } else {
+                    usage();
+                    return 1;
+                }
+                flush = 1;
+                break;
+            case 'i':
+                if (strcmp(optarg, "line") == 0) {
+                    stdin_mode = STDIN_LINE;
+                } else if (strcmp(optarg, "drain") == 0) {
+                    stdin_mode = STDIN_DRAIN;
+                } else {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 't':
+                timestamp = 1;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (argc - optind < 2 || parse_delay(argv[optind + 1], &delay) == -1) {
+        usage();
         return 1;
     }
-    limit = atoi(argv[1]);
-    delay = atoi(argv[2]);
+    limit = atoi(argv[optind]);
 
-    if (argc >= 4) {
-        fout = fopen(argv[3], "w");
+    if (argc - optind >= 3) {
+        fout = fopen(argv[optind + 2], "w");
         if (fout == NULL) {
             perror("fopen");
             return 1;
@@ -24,8 +169,77 @@ int main(int argc, char **argv) {
         fout = stdout;
     }
 
+    if (stdin_mode == STDIN_DRAIN) {
+        char buf[4096];
+        while (fread(buf, 1, sizeof(buf), stdin) > 0) {
+        }
+    }
+
+    // delays are measured from a fixed schedule so that short delays do not
+    // drift by the time spent writing, unless it has fallen behind
+    long long delay_nsec = (long long) delay.tv_sec * NSEC_PER_SEC + delay.tv_nsec;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    char *line = NULL;
+    size_t line_size = 0;
+    char text[32];
     for (int i = 1; i <= limit; i++) {
-        fprintf(fout, "%d\n", i);
-        sleep(delay);
+        const char *record = text;
+        if (stdin_mode == STDIN_LINE) {
+            ssize_t len = getline(&line, &line_size, stdin);
+            if (len == -1) {
+                break;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            record = line;
+        } else {
+            snprintf(text, sizeof(text), "%d", i);
+        }
+        if (write_record(fout, record, size, timestamp) == -1) {
+            perror("write");
+            return 1;
+        }
+
+        // the rest of the burst goes out back to back
+        if (i % burst != 0 && i < limit) {
+            continue;
+        }
+        if (flush && fflush(fout) == EOF) {
+            perror("fflush");
+            return 1;
+        }
+        if (sync_mode == SYNC_EACH && fsync(fileno(fout)) == -1 && errno != EINVAL) {
+            perror("fsync");
+            return 1;
+        }
+
+        long long wait = delay_nsec;
+        if (exponential) {
+            wait = (long long) (-log(1.0 - drand48()) * delay_nsec);
+        }
+        if (wait == 0) {
+            continue;
+        }
+        add_nsec(&next, wait);
+
+        // once behind schedule (e.g., after being stopped with ^Z), the
+        // schedule restarts from now rather than writing the overdue records
+        // back to back
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (time_before(&next, &now)) {
+            next = now;
+            add_nsec(&next, wait);
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+    }
+    free(line);
+
+    if (sync_mode == SYNC_END &&
+        (fflush(fout) == EOF || (fsync(fileno(fout)) == -1 && errno != EINVAL))) {
+        perror("fsync");
+        return 1;
     }
+    return 0;
 }
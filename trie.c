@@ -0,0 +1,204 @@
+#include "trie.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_vector.h"
+
+#define INITIAL_EDGES 2
+
+// Binary search for the edge labeled 'byte'. Returns its index, or else
+// -(insertion point) - 1.
+static int find_edge(const trie_node_t *node, unsigned char byte) {
+  int lo = 0;
+  int hi = (int) node->num_edges - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (node->edges[mid].byte == byte) {
+      return mid;
+    } else if (node->edges[mid].byte < byte) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return -lo - 1;
+}
+
+// Walk down the trie along 's', returns NULL if no string starts with 's'
+static const trie_node_t *descend(const trie_node_t *node, const char *s) {
+  for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++) {
+    int idx = find_edge(node, *c);
+    if (idx < 0) {
+      return NULL;
+    }
+    node = node->edges[idx].node;
+  }
+  return node;
+}
+
+static void free_children(trie_node_t *node) {
+  for (unsigned i = 0; i < node->num_edges; i++) {
+    free_children(node->edges[i].node);
+    free(node->edges[i].node);
+  }
+  free(node->edges);
+  node->edges = NULL;
+  node->num_edges = 0;
+  node->capacity = 0;
+}
+
+void trie_init(trie_t *trie) {
+  memset(&trie->root, 0, sizeof(trie_node_t));
+}
+
+void trie_free(trie_t *trie) {
+  free_children(&trie->root);
+  trie_init(trie);
+}
+
+int trie_insert(trie_t *trie, const char *s) {
+  trie_node_t *node = &trie->root;
+  for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++) {
+    int idx = find_edge(node, *c);
+    if (idx < 0) {
+      idx = -idx - 1;
+      if (node->num_edges == node->capacity) {
+        unsigned capacity = node->capacity == 0 ? INITIAL_EDGES : node->capacity * 2;
+        trie_edge_t *edges = realloc(node->edges, capacity * sizeof(trie_edge_t));
+        if (edges == NULL) {
+          perror("realloc");
+          return -1;
+        }
+        node->edges = edges;
+        node->capacity = capacity;
+      }
+      trie_node_t *child = calloc(1, sizeof(trie_node_t));
+      if (child == NULL) {
+        perror("calloc");
+        return -1;
+      }
+      memmove(&node->edges[idx + 1], &node->edges[idx],
+              (node->num_edges - idx) * sizeof(trie_edge_t));
+      node->edges[idx].byte = *c;
+      node->edges[idx].node = child;
+      node->num_edges++;
+    }
+    node = node->edges[idx].node;
+  }
+
+  if (node->refs++ > 0) {
+    return 0;
+  }
+  // a new string: every node on its path gains an entry
+  node = &trie->root;
+  node->entries++;
+  for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++) {
+    node = node->edges[find_edge(node, *c)].node;
+    node->entries++;
+  }
+  return 0;
+}
+
+// Returns 1 if the last reference to 's' was dropped, 0 if references
+// remain, or -1 if 's' is not below 'node'. Nodes left without entries are
+// pruned on the way back up.
+static int remove_below(trie_node_t *node, const unsigned char *s) {
+  if (*s == '\0') {
+    if (node->refs == 0) {
+      return -1;
+    }
+    node->refs--;
+    if (node->refs > 0) {
+      return 0;
+    }
+    node->entries--;
+    return 1;
+  }
+
+  int idx = find_edge(node, *s);
+  if (idx < 0) {
+    return -1;
+  }
+  trie_node_t *child = node->edges[idx].node;
+  int ret = remove_below(child, s + 1);
+  if (ret != 1) {
+    return ret;
+  }
+
+  node->entries--;
+  if (child->entries == 0) {
+    free_children(child);
+    free(child);
+    memmove(&node->edges[idx], &node->edges[idx + 1],
+            (node->num_edges - idx - 1) * sizeof(trie_edge_t));
+    node->num_edges--;
+  }
+  return 1;
+}
+
+int trie_remove(trie_t *trie, const char *s) {
+  return remove_below(&trie->root, (const unsigned char *) s) == -1 ? -1 : 0;
+}
+
+unsigned trie_count(const trie_t *trie, const char *prefix) {
+  const trie_node_t *node = descend(&trie->root, prefix);
+  return node == NULL ? 0 : node->entries;
+}
+
+int trie_common_prefix(const trie_t *trie, const char *prefix, char *common, unsigned size) {
+  const trie_node_t *node = descend(&trie->root, prefix);
+  unsigned len = strlen(prefix);
+  if (node == NULL || len >= size) {
+    if (size > 0) {
+      common[0] = '\0';
+    }
+    return node == NULL ? 0 : -1;
+  }
+
+  strcpy(common, prefix);
+  // extend while every string below continues with the same byte
+  while (node->refs == 0 && node->num_edges == 1 && len + 1 < size) {
+    common[len++] = node->edges[0].byte;
+    node = node->edges[0].node;
+  }
+  common[len] = '\0';
+  return 0;
+}
+
+// Depth-first walk adding every string below 'node', 'buf' holds the
+// string leading to 'node'
+static int collect(const trie_node_t *node, char *buf, unsigned len, strvec_t *matches,
+                   unsigned max) {
+  if (node->refs > 0 && matches->length < max) {
+    buf[len] = '\0';
+    if (strvec_add(matches, buf) == -1) {
+      return -1;
+    }
+  }
+  if (len + 1 >= PATH_MAX) {
+    return 0;
+  }
+  for (unsigned i = 0; i < node->num_edges && matches->length < max; i++) {
+    buf[len] = node->edges[i].byte;
+    if (collect(node->edges[i].node, buf, len + 1, matches, max) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int trie_matches(const trie_t *trie, const char *prefix, strvec_t *matches, unsigned max) {
+  const trie_node_t *node = descend(&trie->root, prefix);
+  unsigned len = strlen(prefix);
+  if (node == NULL || len >= PATH_MAX) {
+    return 0;
+  }
+
+  char buf[PATH_MAX];
+  strcpy(buf, prefix);
+  // 'max' counts strings added by this call
+  return collect(node, buf, len, matches, matches->length + max);
+}
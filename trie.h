@@ -0,0 +1,86 @@
+#ifndef TRIE_H
+#define TRIE_H
+
+#include "string_vector.h"
+
+typedef struct trie_node trie_node_t;
+
+// Link from a node to the child reached by one more byte
+typedef struct {
+  unsigned char byte;
+  trie_node_t *node;
+} trie_edge_t;
+
+struct trie_node {
+  trie_edge_t *edges;     // children, sorted by byte
+  unsigned num_edges;
+  unsigned capacity;
+  unsigned refs;          // times the string ending here has been inserted
+  unsigned entries;       // distinct strings in this subtree (including here)
+};
+
+// A set of strings that supports fast prefix queries. Strings are reference
+// counted, so the same string may be inserted by several sources and stays
+// in the trie until every one of them has removed it.
+typedef struct {
+  trie_node_t root;
+} trie_t;
+
+/*
+ * Initialize an empty trie
+ * trie: The trie to initialize
+ */
+void trie_init(trie_t *trie);
+
+/*
+ * Free all memory used by a trie, leaving it empty
+ * trie: The trie to free
+ */
+void trie_free(trie_t *trie);
+
+/*
+ * Add a reference to a string, inserting it if it is not yet in the trie
+ * trie: The trie to insert into
+ * s: The string to insert
+ * Returns 0 on success or -1 on error
+ */
+int trie_insert(trie_t *trie, const char *s);
+
+/*
+ * Drop a reference to a string, removing it once no references remain
+ * trie: The trie to remove from
+ * s: The string to remove
+ * Returns 0 on success or -1 if 's' is not in the trie
+ */
+int trie_remove(trie_t *trie, const char *s);
+
+/*
+ * Count the strings that start with a prefix
+ * trie: The trie to search
+ * prefix: The prefix to look for, "" matches every string
+ * Returns the number of distinct strings starting with 'prefix'
+ */
+unsigned trie_count(const trie_t *trie, const char *prefix);
+
+/*
+ * Find the longest prefix shared by all strings that start with 'prefix'
+ * trie: The trie to search
+ * prefix: The prefix to look for
+ * common: Buffer in which to store the shared prefix (which begins with
+ *         'prefix'), or "" if no string starts with 'prefix'
+ * size: Size of the 'common' buffer
+ * Returns 0 on success or -1 on error
+ */
+int trie_common_prefix(const trie_t *trie, const char *prefix, char *common, unsigned size);
+
+/*
+ * List strings that start with a prefix, in byte order
+ * trie: The trie to search
+ * prefix: The prefix to look for
+ * matches: Vector to which the matching strings are added
+ * max: Stop after adding this many strings
+ * Returns 0 on success or -1 on error
+ */
+int trie_matches(const trie_t *trie, const char *prefix, strvec_t *matches, unsigned max);
+
+#endif    // TRIE_H
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+
+#include "watch_run.h"
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "string_vector.h"
+#include "swish_funcs.h"
+
+// Changes to a watched file's directory entry that warrant a re-run. The
+// directory is watched rather than the file so that files replaced by
+// rename (as many editors do) stay watched. IN_MODIFY catches writers that
+// keep the file open, such as a log appender, its bursts are debounced.
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+typedef struct {
+  int wd;          // inotify watch descriptor of the file's directory
+  char *name;      // file name within that directory
+} watch_t;
+
+// Split the "watch-run" options off the front of 'tokens', leaving only the
+// command, and collect the files to watch into 'files'
+static int parse_watch_args(strvec_t *tokens, strvec_t *files) {
+  unsigned i = 1;
+  while (i < tokens->length) {
+    const char *token = strvec_get(tokens, i);
+    if (strcmp(token, "-f") == 0) {
+      if (i + 1 == tokens->length) {
+        fprintf(stderr, "Usage: watch-run [-f <file>]... [--] <command>\n");
+        return -1;
+      }
+      if (strvec_add(files, strvec_get(tokens, i + 1)) == -1) {
+        return -1;
+      }
+      i += 2;
+    } else if (strcmp(token, "--") == 0) {
+      i++;
+      break;
+    } else {
+      break;
+    }
+  }
+  strvec_drop(tokens, i);
+
+  if (tokens->length == 0) {
+    fprintf(stderr, "Usage: watch-run [-f <file>]... [--] <command>\n");
+    return -1;
+  }
+
+  // by default, watch every file the command reads its input from
+  if (files->length == 0) {
+    for (unsigned j = 0; j + 1 < tokens->length; j++) {
+      if (strcmp(strvec_get(tokens, j), "<") == 0 &&
+          strvec_add(files, strvec_get(tokens, j + 1)) == -1) {
+        return -1;
+      }
+    }
+  }
+  if (files->length == 0) {
+    fprintf(stderr, "watch-run: no files to watch\n");
+    return -1;
+  }
+  return 0;
+}
+
+static int add_watches(int inotify_fd, const strvec_t *files,
+                       watch_t *watches) {
+  for (unsigned i = 0; i < files->length; i++) {
+    // dirname() and basename() may modify their argument
+    char dir_buf[PATH_MAX];
+    char name_buf[PATH_MAX];
+    snprintf(dir_buf, PATH_MAX, "%s", strvec_get(files, i));
+    snprintf(name_buf, PATH_MAX, "%s", strvec_get(files, i));
+
+    // watching the same directory twice returns the same descriptor
+    watches[i].wd = inotify_add_watch(inotify_fd, dirname(dir_buf),
+                                      WATCH_EVENTS);
+    if (watches[i].wd == -1) {
+      perror("inotify_add_watch");
+      return -1;
+    }
+    if ((watches[i].name = strdup(basename(name_buf))) == NULL) {
+      perror("strdup");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Wait up to 'timeout_ms' (or forever if negative) for a change to a watched
+// file. Returns 1 if one happened, 0 on timeout, or -1 on error.
+static int wait_for_change(int inotify_fd, const watch_t *watches,
+                           unsigned num_watches, int timeout_ms) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (1) {
+    struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return -1;
+    } else if (ready == 0) {
+      return 0;
+    }
+
+    ssize_t len = read(inotify_fd, buf, sizeof(buf));
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("read");
+      return -1;
+    }
+
+    // other files in the same directories also generate events
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *event = (const struct inotify_event *) p;
+      for (unsigned i = 0; i < num_watches; i++) {
+        if (event->len > 0 && event->wd == watches[i].wd &&
+            strcmp(event->name, watches[i].name) == 0) {
+          return 1;
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+// run the command in a child process and wait for it to finish, storing its
+// wait status in 'status'
+static int run_once(strvec_t *tokens, int *status) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    // stays in the watcher's process group, so the whole job can be
+    // stopped, resumed and killed together
+    exec_command(tokens);
+    exit(1);
+  }
+
+  while (waitpid(pid, status, 0) == -1) {
+    if (errno != EINTR) {
+      perror("waitpid");
+      return -1;
+    }
+  }
+
+  // the watcher outlives each run, so report failed runs as they happen
+  if (WIFEXITED(*status) && WEXITSTATUS(*status) != 0) {
+    fprintf(stderr, "watch-run: %s exited with status %d\n",
+            strvec_get(tokens, 0), WEXITSTATUS(*status));
+  } else if (WIFSIGNALED(*status)) {
+    fprintf(stderr, "watch-run: %s killed by signal %d\n",
+            strvec_get(tokens, 0), WTERMSIG(*status));
+  }
+  return 0;
+}
+
+int watch_run(strvec_t *tokens) {
+  // the watcher leads the job's process group, like run_command() would
+  if (setpgid(0, 0) == -1) {
+    perror("setpgid");
+    return -1;
+  }
+
+  strvec_t files;
+  if (strvec_init(&files) == -1) {
+    return -1;
+  }
+  if (parse_watch_args(tokens, &files) == -1) {
+    strvec_clear(&files);
+    return -1;
+  }
+
+  int inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd == -1) {
+    perror("inotify_init1");
+    strvec_clear(&files);
+    return -1;
+  }
+  unsigned num_watches = files.length;
+  watch_t *watches = calloc(num_watches, sizeof(watch_t));
+  if (watches == NULL) {
+    perror("calloc");
+    close(inotify_fd);
+    strvec_clear(&files);
+    return -1;
+  }
+
+  // watches are in place before the first run, so no change can be missed
+  int ret = add_watches(inotify_fd, &files, watches);
+  int status = 0;
+  while (ret == 0) {
+    if (run_once(tokens, &status) == -1) {
+      ret = -1;
+      break;
+    }
+
+    // block until something changes, then let a burst of changes settle,
+    // but for no longer than DEBOUNCE_MAX_MS since its first change
+    int changed = wait_for_change(inotify_fd, watches, num_watches, -1);
+    struct timespec first;
+    clock_gettime(CLOCK_MONOTONIC, &first);
+    while (changed == 1) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      long elapsed_ms = (now.tv_sec - first.tv_sec) * 1000 +
+                        (now.tv_nsec - first.tv_nsec) / 1000000;
+      if (elapsed_ms >= DEBOUNCE_MAX_MS) {
+        break;
+      }
+      long left_ms = DEBOUNCE_MAX_MS - elapsed_ms;
+      changed = wait_for_change(inotify_fd, watches, num_watches,
+                                left_ms < DEBOUNCE_MS ? left_ms : DEBOUNCE_MS);
+    }
+    if (changed == -1) {
+      ret = -1;
+    }
+  }
+
+  for (unsigned i = 0; i < num_watches; i++) {
+    free(watches[i].name);
+  }
+  free(watches);
+  close(inotify_fd);
+  strvec_clear(&files);
+  return ret;
+}
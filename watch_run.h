@@ -0,0 +1,27 @@
+#ifndef WATCH_RUN_H
+#define WATCH_RUN_H
+
+#include "string_vector.h"
+
+// Quiet period (milliseconds) that must follow a change before a re-run, so a
+// burst of writes to the watched files triggers only one run
+#define DEBOUNCE_MS 100
+// Longest wait (milliseconds) from the first change of a burst to the re-run,
+// so that a file written continuously still triggers runs
+#define DEBOUNCE_MAX_MS 1000
+
+/*
+ * Run a "watch-run" command: "watch-run [-f <file>]... [--] <command>"
+ * The command runs once, then again each time one of the watched files
+ * changes. Files are given with -f, or else default to the command's "<" input
+ * files. Changes are detected with inotify and bursts of changes are
+ * coalesced, for at most DEBOUNCE_MAX_MS before the next run. Like
+ * run_command(), this should be called within a CHILD process of the shell,
+ * which then stands in for the job until it is killed.
+ * A run that fails is reported on stderr with its exit status or signal.
+ * tokens: Tokens input by user into shell, starting with "watch-run"
+ * Returns -1 on error, otherwise does not return
+ */
+int watch_run(strvec_t *tokens);
+
+#endif    // WATCH_RUN_H